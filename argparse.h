@@ -25,7 +25,8 @@ typedef int (*argparse_optionhandler_t)
 typedef struct argparse_option {
 	char short_name; /* Short option name to be used like `-o [arg]` or `-o[arg]`. Assign 0 to disable. */
 	const char *long_name; /* Long option name to be used like `--opt [arg]` or `--opt=[arg]`. Assign NULL to disable. */
-	const char *argument; /* Name of argument which will be printed by argparse_help(). Assign NULL to disable. */
+	const char *argument; /* Name of argument which will be printed by argparse_help(). Assign NULL to disable.
+		Names starting with '[' (like "[=ARG]") mark optional arguments, given only as `--opt=arg` or `-oarg`. */
 	const char *help; /* Help message which will be used by argparse_help(). Nullable. */
 	argparse_optionhandler_t handler; /* The option handler. */
 } argparse_option_t;
@@ -129,6 +130,9 @@ ARGPARSE_INLINE int argparse_parse(
 				if (equal_pos) {
 					if (opt->handler(data, opt, equal_pos + 1))
 						RETURN_ERR(ARGPARSE_ERR_TERM, arg_index);
+				} else if (opt->argument[0] == '[') {
+					if (opt->handler(data, opt, NULL))
+						RETURN_ERR(ARGPARSE_ERR_TERM, arg_index);
 				} else {
 					const char *const opt_arg = argv[arg_index + 1];
 					if (arg_index + 1 >= argc || opt_arg[0] == '-')
@@ -162,6 +166,9 @@ ARGPARSE_INLINE int argparse_parse(
 				if (arg_str[2]) {
 					if (opt->handler(data, opt, arg_str + 2))
 						RETURN_ERR(ARGPARSE_ERR_TERM, arg_index);
+				} else if (opt->argument[0] == '[') {
+					if (opt->handler(data, opt, NULL))
+						RETURN_ERR(ARGPARSE_ERR_TERM, arg_index);
 				} else {
 					const char *const opt_arg = argv[arg_index + 1];
 					if (arg_index + 1 >= argc || opt_arg[0] == '-')
@@ -229,9 +236,12 @@ ARGPARSE_INLINE void argparse_help(const argparse_program_t *prog) ARGPARSE_NOEX
 		}
 		if (opt->argument) {
 			const size_t n = strlen(opt->argument);
-			fputc(' ', stdout);
+			if (opt->argument[0] != '[') {
+				fputc(' ', stdout);
+				char_count += 1;
+			}
 			fwrite(opt->argument, 1, n, stdout);
-			char_count += 1 + n;
+			char_count += n;
 		}
 		fputc(' ', stdout);
 		char_count += 1;
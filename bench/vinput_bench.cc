@@ -0,0 +1,686 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <initializer_list>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/input.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#if VINPUT_DESKTOP_X11 || VINPUT_DESKTOP_XCB
+#	include <csignal>
+#	include <spawn.h>
+#	include <sys/wait.h>
+#endif // VINPUT_DESKTOP_X11 || VINPUT_DESKTOP_XCB
+
+#include "desktop.h"
+#include "desktops.h"
+#include "image_search.h"
+#include "script.h"
+
+using namespace vinput;
+
+namespace {
+
+// Mock of the uinput devices. Messages written to a SOCK_SEQPACKET socket
+// keep their boundaries, so each message received is exactly one `write()`.
+class MockUinput {
+public:
+	MockUinput();
+	~MockUinput();
+
+	MockUinput(const MockUinput &) = delete;
+	MockUinput &operator=(const MockUinput &) = delete;
+
+	// Take the writing ends, which will be closed by the desktop.
+	std::pair<int, int> take_fds() noexcept;
+	// Wait until the writing ends are closed.
+	void join() noexcept;
+	void reset_counters() noexcept;
+
+	std::size_t writes() const noexcept { return this->write_count; }
+	std::size_t events() const noexcept { return this->event_count; }
+
+private:
+	int fds_read[2], fds_write[2];
+	std::thread reader;
+	std::atomic_size_t write_count = 0, event_count = 0;
+
+	void read_loop() noexcept;
+};
+
+// A measured value and its unit, like {"events/s", 1e6}.
+struct Metric {
+	const char *unit;
+	double value;
+};
+
+// Time of running something.
+struct Timing {
+	double seconds;
+	double cpu_seconds; // Of the calling thread.
+};
+
+#if VINPUT_DESKTOP_X11 || VINPUT_DESKTOP_XCB
+
+// A virtual X server started for the benchmark, if Xvfb is installed.
+class Xvfb {
+public:
+	Xvfb() noexcept;
+	~Xvfb();
+
+	Xvfb(const Xvfb &) = delete;
+	Xvfb &operator=(const Xvfb &) = delete;
+
+	// Display name, or empty if not started.
+	const std::string &display() const noexcept { return this->display_name; }
+
+private:
+	pid_t pid = -1;
+	std::string display_name;
+};
+
+#endif // VINPUT_DESKTOP_X11 || VINPUT_DESKTOP_XCB
+
+}
+
+// Print results as JSON lines instead of a table.
+static bool jsonl_output = false;
+// Lines of a previous JSON lines output by benchmark name, to compare with.
+static std::map<std::string, std::string, std::less<>> baseline;
+
+#if VINPUT_DESKTOP_X11 || VINPUT_DESKTOP_XCB
+extern char **environ;
+#endif // VINPUT_DESKTOP_X11 || VINPUT_DESKTOP_XCB
+
+MockUinput::MockUinput() {
+	for (int i = 0; i < 2; i++) {
+		int fds[2];
+		if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds)) {
+			std::perror("socketpair");
+			std::exit(EXIT_FAILURE);
+		}
+		// Like "/dev/uinput" opened by the desktop.
+		fcntl(fds[1], F_SETFL, O_NONBLOCK);
+		this->fds_read[i] = fds[0];
+		this->fds_write[i] = fds[1];
+	}
+	this->reader = std::thread(&MockUinput::read_loop, this);
+}
+
+MockUinput::~MockUinput() {
+	this->join();
+	for (const auto fd : this->fds_read)
+		close(fd);
+}
+
+std::pair<int, int> MockUinput::take_fds() noexcept {
+	return {this->fds_write[0], this->fds_write[1]};
+}
+
+void MockUinput::join() noexcept {
+	if (this->reader.joinable())
+		this->reader.join();
+}
+
+void MockUinput::reset_counters() noexcept {
+	this->write_count = 0;
+	this->event_count = 0;
+}
+
+void MockUinput::read_loop() noexcept {
+	pollfd pfds[2];
+	for (int i = 0; i < 2; i++)
+		pfds[i] = {.fd = this->fds_read[i], .events = POLLIN, .revents = 0};
+	int open_count = 2;
+	char buffer[4096];
+	while (open_count) {
+		if (poll(pfds, 2, -1) <= 0)
+			continue;
+		for (auto &pfd : pfds) {
+			if (!pfd.revents)
+				continue;
+			const auto n = read(pfd.fd, buffer, sizeof buffer);
+			if (n <= 0) {
+				pfd.fd = -1;
+				open_count--;
+				continue;
+			}
+			this->write_count++;
+			this->event_count += std::size_t(n) / sizeof(input_event);
+		}
+	}
+}
+
+static double thread_cpu_seconds() noexcept {
+	rusage usage;
+	getrusage(RUSAGE_THREAD, &usage);
+	return double(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+		double(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+}
+
+static void load_baseline(const char *path) {
+	std::ifstream file(path);
+	if (!file.is_open()) {
+		std::perror(path);
+		std::exit(EXIT_FAILURE);
+	}
+	constexpr std::string_view prefix = "{\"bench\":\"";
+	for (std::string line; std::getline(file, line); ) {
+		if (!line.starts_with(prefix))
+			continue;
+		const auto name_end = line.find('"', prefix.size());
+		if (name_end != std::string::npos)
+			baseline[line.substr(prefix.size(), name_end - prefix.size())] = line;
+	}
+}
+
+// Speedup over the baseline by the first rate or time metric. 0 if unknown.
+static double baseline_speedup(
+		std::string_view name, std::initializer_list<Metric> metrics) noexcept {
+	const auto iter = baseline.find(name);
+	if (iter == baseline.end())
+		return 0;
+	for (const auto &m : metrics) {
+		const std::string_view unit = m.unit;
+		const bool is_rate = unit.ends_with("/s");
+		const bool is_time = unit.starts_with("ns/");
+		if (!is_rate && !is_time)
+			continue;
+		const auto key = '"' + std::string(unit) + "\":";
+		const auto pos = iter->second.find(key);
+		if (pos == std::string::npos)
+			return 0;
+		const auto base_value = std::strtod(iter->second.c_str() + pos + key.size(), nullptr);
+		if (!(base_value > 0 && m.value > 0))
+			return 0;
+		return is_rate ? m.value / base_value : base_value / m.value;
+	}
+	return 0;
+}
+
+static void report(std::string_view name, std::initializer_list<Metric> metrics) {
+	const auto speedup = baseline_speedup(name, metrics);
+	if (jsonl_output) {
+		std::printf("{\"bench\":\"%.*s\"", int(name.size()), name.data());
+		for (const auto &m : metrics)
+			std::printf(",\"%s\":%.10g", m.unit, m.value);
+		if (speedup)
+			std::printf(",\"speedup\":%.4f", speedup);
+		std::printf("}\n");
+	} else {
+		std::printf("%-34.*s", int(name.size()), name.data());
+		for (const auto &m : metrics) {
+			const bool whole = m.value == double(std::int64_t(m.value));
+			std::printf(whole ? " %10.0f %s" : " %10.2f %s", m.value, m.unit);
+		}
+		if (speedup)
+			std::printf(" %6.3fx speedup", speedup);
+		std::printf("\n");
+	}
+	std::fflush(stdout);
+}
+
+template <typename Func> static Timing measure(Func &&func) {
+	const auto cpu0 = thread_cpu_seconds();
+	const auto t0 = std::chrono::steady_clock::now();
+	func();
+	const auto t1 = std::chrono::steady_clock::now();
+	const auto cpu1 = thread_cpu_seconds();
+	return {std::chrono::duration<double>(t1 - t0).count(), cpu1 - cpu0};
+}
+
+// Run the action `n` times, flushing after each like the player does. Ends
+// when the desktop has handled all, so that queued events are counted too.
+static Timing run_actions(Desktop &desktop, std::size_t n, void (*action)(Desktop &)) {
+	return measure([&] {
+		for (std::size_t i = 0; i < n; i++) {
+			action(desktop);
+			desktop.flush();
+		}
+		desktop.sync();
+	});
+}
+
+// Per-event cost of actions of two events each.
+static void bench_action(
+		Desktop &desktop, const std::string &group, const char *name,
+		std::size_t n, void (*action)(Desktop &)) {
+	const auto t = run_actions(desktop, n, action);
+	const auto events = double(n) * 2;
+	report(group + '/' + name, {
+		{"actions", double(n)},
+		{"events/s", events / t.seconds},
+		{"ns/event", t.seconds * 1e9 / events},
+		{"cpu-ns/event", t.cpu_seconds * 1e9 / events},
+	});
+}
+
+static void bench_uinput_action(
+		MockUinput &mock, Desktop &desktop, const char *group, const char *name,
+		std::size_t n, void (*action)(Desktop &)) {
+	// Let the reader drain the setup writes before counting.
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	mock.reset_counters();
+	const auto t = run_actions(desktop, n, action);
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+	const auto writes = double(mock.writes()), events = double(mock.events());
+	report(std::string(group) + '/' + name, {
+		{"actions", double(n)},
+		{"writes/action", writes / double(n)},
+		{"events/write", writes ? events / writes : 0.0},
+		{"events/s", events / t.seconds},
+		{"cpu-ns/event", events ? t.cpu_seconds * 1e9 / events : 0.0},
+	});
+}
+
+static void bench_uinput(std::size_t n, bool composite, bool io_uring) {
+	using enum Desktop::PressAction;
+
+	const auto group =
+		std::string(composite ? "uinput_composite" : "uinput") + (io_uring ? "_io_uring" : "");
+	linux_desktop_options.screen_width = 1920;
+	linux_desktop_options.screen_height = 1080;
+	linux_desktop_options.composite = composite;
+	linux_desktop_options.io_uring = io_uring;
+
+	MockUinput mock;
+	auto [fd_keyboard, fd_mouse] = mock.take_fds();
+	if (composite) {
+		close(fd_mouse);
+		fd_mouse = -1;
+	}
+	Desktop *const desktop = connect_linux_desktop(fd_keyboard, fd_mouse);
+
+	const auto g = group.c_str();
+	bench_uinput_action(mock, *desktop, g, "key", n, [](Desktop &d) {
+		d.key(Desktop::Key::a, Press);
+		d.key(Desktop::Key::a, Release);
+	});
+	bench_uinput_action(mock, *desktop, g, "key_shifted", n, [](Desktop &d) {
+		d.key(Desktop::Key::A, Press);
+		d.key(Desktop::Key::A, Release);
+	});
+	bench_uinput_action(mock, *desktop, g, "button", n, [](Desktop &d) {
+		d.button(Desktop::Button::LEFT, Press);
+		d.button(Desktop::Button::LEFT, Release);
+	});
+	bench_uinput_action(mock, *desktop, g, "wheel", n, [](Desktop &d) {
+		d.button(Desktop::Button::SCROLL_DOWN, Press);
+	});
+	bench_uinput_action(mock, *desktop, g, "scroll_hi_res", n, [](Desktop &d) {
+		d.scroll(0, -Desktop::SCROLL_NOTCH / 4);
+	});
+	bench_uinput_action(mock, *desktop, g, "pointer_abs", n, [](Desktop &d) {
+		d.pointer({100, 200});
+	});
+
+	const auto stats = linux_desktop_stats(*desktop);
+	report(group + "/queue", {
+		{"written", double(stats.written)},
+		{"retried", double(stats.retried)},
+		{"dropped", double(stats.dropped)},
+	});
+
+	disconnect_desktop(desktop);
+	mock.join();
+}
+
+static void bench_actions(Desktop &desktop, const std::string &group, std::size_t n) {
+	using enum Desktop::PressAction;
+
+	bench_action(desktop, group, "key", n, [](Desktop &d) {
+		d.key(Desktop::Key::a, Press);
+		d.key(Desktop::Key::a, Release);
+	});
+	bench_action(desktop, group, "button", n, [](Desktop &d) {
+		d.button(Desktop::Button::LEFT, Press);
+		d.button(Desktop::Button::LEFT, Release);
+	});
+	bench_action(desktop, group, "pointer", n, [](Desktop &d) {
+		d.pointer({100, 200});
+		d.pointer({200, 100});
+	});
+}
+
+static void bench_test_desktop(std::size_t n) {
+	static constexpr std::pair<TestDesktopOptions::Format, const char *> formats[] = {
+		{TestDesktopOptions::TEXT, "test_text"},
+		{TestDesktopOptions::JSONL, "test_jsonl"},
+		{TestDesktopOptions::BINARY, "test_binary"},
+	};
+	for (const auto &[format, group] : formats) {
+		test_desktop_options.format = format;
+		test_desktop_options.path = "/dev/null";
+		Desktop *const desktop = connect_test_desktop();
+		bench_actions(*desktop, group, n);
+		disconnect_desktop(desktop);
+	}
+	test_desktop_options = { };
+}
+
+#if VINPUT_DESKTOP_X11 || VINPUT_DESKTOP_XCB
+
+Xvfb::Xvfb() noexcept {
+	// Xvfb picks a free display and writes its number to the pipe.
+	int fds[2];
+	if (pipe(fds))
+		return;
+	const auto fd_arg = std::to_string(fds[1]);
+	const char *const argv[] = {
+		"Xvfb", "-displayfd", fd_arg.c_str(), "-nolisten", "tcp",
+		"-screen", "0", "1920x1080x24", "-br", nullptr}; // Full HD, black root window.
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_addclose(&actions, fds[0]);
+	posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+	const auto spawn_status = posix_spawnp(
+		&this->pid, "Xvfb", &actions, nullptr, const_cast<char *const *>(argv), environ);
+	posix_spawn_file_actions_destroy(&actions);
+	close(fds[1]);
+	if (spawn_status) {
+		this->pid = -1;
+		close(fds[0]);
+		return;
+	}
+
+	pollfd pfd = {.fd = fds[0], .events = POLLIN, .revents = 0};
+	char buffer[16];
+	ssize_t n = 0;
+	if (poll(&pfd, 1, 5000) > 0)
+		n = read(fds[0], buffer, sizeof buffer - 1);
+	close(fds[0]);
+	if (n <= 0)
+		return;
+	buffer[n] = '\0';
+	this->display_name = ':' + std::to_string(std::atoi(buffer));
+}
+
+Xvfb::~Xvfb() {
+	if (this->pid <= 0)
+		return;
+	kill(this->pid, SIGTERM);
+	waitpid(this->pid, nullptr, 0);
+}
+
+#endif // VINPUT_DESKTOP_X11 || VINPUT_DESKTOP_XCB
+
+#if VINPUT_DESKTOP_X11
+
+// Latency of screen captures, and of waits for colors already on the screen.
+static void bench_capture(Desktop &desktop, const std::string &group, std::size_t n) {
+	static constexpr std::pair<const char *, Desktop::ScreenArea> areas[] = {
+		{"capture_pixel", {0, 0, 1, 1}},
+		{"capture_full_hd", {0, 0, 1920, 1080}},
+	};
+	for (const auto &[name, area] : areas) {
+		std::vector<std::uint32_t> pixels(std::size_t(area.width) * area.height);
+		const auto count = std::max(n * 100 / pixels.size(), std::size_t(10));
+		const auto t = measure([&] {
+			for (std::size_t i = 0; i < count; i++)
+				desktop.capture(area, pixels.data());
+		});
+		report(group + '/' + name, {
+			{"captures", double(count)},
+			{"us/capture", t.seconds * 1e6 / double(count)},
+			{"cpu-us/capture", t.cpu_seconds * 1e6 / double(count)},
+		});
+	}
+
+	// Not in a loop, which would sleep after each round.
+	const auto count = std::clamp(n / 100, std::size_t(10), std::size_t(4000));
+	std::string source;
+	for (std::size_t i = 0; i < count; i++)
+		source += "\\[~960,540,000000]";
+	std::istringstream source_stream(source);
+	const Script script(source_stream);
+	const auto t = measure([&] { script.play(desktop); });
+	report(group + "/wait_ready", {
+		{"waits", double(count)},
+		{"us/wait", t.seconds * 1e6 / double(count)},
+	});
+}
+
+#endif // VINPUT_DESKTOP_X11
+
+#if VINPUT_DESKTOP_X11 || VINPUT_DESKTOP_XCB
+
+// Xlib and XCB back ends on the same server, to compare them.
+static void bench_xvfb(std::size_t n) {
+	const Xvfb server;
+	if (server.display().empty()) {
+		std::fprintf(stderr, "Xvfb not available, skipped\n");
+		return;
+	}
+#if VINPUT_DESKTOP_X11
+	Desktop *const x11 = connect_x11_desktop(server.display().c_str());
+	bench_actions(*x11, "x11_xvfb", n);
+	bench_capture(*x11, "x11_xvfb", n);
+	disconnect_desktop(x11);
+#endif // VINPUT_DESKTOP_X11
+#if VINPUT_DESKTOP_XCB
+	Desktop *const xcb = connect_xcb_desktop(server.display().c_str());
+	bench_actions(*xcb, "xcb_xvfb", n);
+	disconnect_desktop(xcb);
+#endif // VINPUT_DESKTOP_XCB
+}
+
+#endif // VINPUT_DESKTOP_X11 || VINPUT_DESKTOP_XCB
+
+// Throughput of compiling the source, repeated for a while.
+static void bench_compile(const char *name, const std::string &source) {
+	Script script;
+	std::size_t rounds = 0;
+	const auto t = measure([&] {
+		const auto end_time = std::chrono::steady_clock::now() + std::chrono::milliseconds(500);
+		do {
+			std::istringstream ss(source);
+			script.clear();
+			script.append(ss);
+			rounds++;
+		} while (std::chrono::steady_clock::now() < end_time);
+	});
+	const auto bytes = double(source.size()) * double(rounds);
+	report(std::string("compile/") + name, {
+		{"bytes", double(source.size())},
+		{"MB/s", bytes / t.seconds * 1e-6},
+	});
+}
+
+static void bench_compiler() {
+	// Prose, where every character is a key.
+	std::string text;
+	constexpr std::string_view sentence = "The quick brown fox, jumps over 13 lazy dogs! ";
+	while (text.size() < (1 << 20))
+		text += sentence;
+	bench_compile("text", text);
+
+	// Commands of each kind. Pointer positions and scrolls take a slot each,
+	// and there are 4096 slots.
+	std::string commands;
+	constexpr std::string_view commands_part =
+		"\\[$ESCAPE]\\[$SHIFT_L,v]x\\[$SHIFT_L,^]\\[#0.05]\\<\\>\\|\\[%LEFT,v]\\[%LEFT,^]"
+		"\\[{3]ab\\}\\[=title:bench]\\[=]\\n\\t\\s\\\\";
+	constexpr std::string_view pointer_part = "\\[@1920,1080]\\[|v,2,0.1]";
+	for (std::size_t i = 0; i < 2000; i++) {
+		commands += commands_part;
+		commands += pointer_part;
+	}
+	bench_compile("commands", commands);
+}
+
+// Time of dispatching instructions, with the null desktop on a simulated clock.
+static void bench_player(bool random_sleep) {
+	// Loops of loops, as operands are limited to 4095.
+	constexpr std::size_t outer = 1000, inner = 1000, body = 3;
+	std::istringstream ss("\\[{1000]\\[{1000]a\\[@10,20]\\}\\}");
+	const Script script(ss);
+	const auto instructions = double(1 + outer * (1 + inner * body + 1));
+
+	Script::random_sleep = random_sleep;
+	Desktop *const desktop = connect_named_desktop("null");
+	const auto t = measure([&] { script.play(*desktop); });
+	disconnect_desktop(desktop);
+	Script::random_sleep = true;
+
+	report(random_sleep ? "player/null" : "player/null_no_rand", {
+		{"instructions", instructions},
+		{"ns/instruction", t.seconds * 1e9 / instructions},
+	});
+}
+
+// Time of finding images of a few sizes on a full-HD screenshot.
+static void bench_image_search() {
+	constexpr unsigned int width = 1920, height = 1080;
+	constexpr std::size_t searches = 50;
+	// A light background with noise, like a window, and images of noise on it.
+	std::mt19937 rand_gen(1);
+	std::vector<std::uint32_t> screen(std::size_t(width) * height);
+	for (auto &pixel : screen)
+		pixel = 0xe0e0e0 ^ (rand_gen() & 0x070707);
+
+	for (const auto &[image_width, image_height] : {
+			std::pair{16u, 16u}, std::pair{64u, 32u}, std::pair{200u, 120u}}) {
+		const auto x0 = width - image_width - 7, y0 = height - image_height - 5;
+		Image image;
+		image.width = image_width;
+		image.height = image_height;
+		for (unsigned int y = 0; y < image_height; y++) {
+			for (unsigned int x = 0; x < image_width; x++) {
+				const auto pixel = rand_gen() & 0xffffff;
+				screen[std::size_t(y0 + y) * width + x0 + x] = pixel;
+				image.pixels.push_back(pixel);
+			}
+		}
+
+		ImageSearch search(image);
+		std::size_t found = 0;
+		const auto t = measure([&] {
+			for (std::size_t i = 0; i < searches; i++) {
+				const auto [pos, ok] = search.find(screen.data(), width, height, 8);
+				found += ok && pos.x == x0 && pos.y == y0;
+			}
+		});
+		report("image_search/" + std::to_string(image_width) + 'x' + std::to_string(image_height), {
+			{"searches", double(searches)},
+			{"found", double(found)},
+			{"us/search", t.seconds * 1e6 / double(searches)},
+		});
+	}
+}
+
+// Rounds of a key click on each of many composite devices, as the load
+// generator does: flushed after each click, or written together by a ring.
+static void bench_uinput_load(std::size_t n, bool io_uring) {
+	using enum Desktop::PressAction;
+	constexpr std::size_t DEVICE_COUNT = 16;
+
+	const std::string group = io_uring ? "uinput_load_io_uring" : "uinput_load";
+	const auto saved_options = linux_desktop_options;
+	linux_desktop_options.composite = true;
+	linux_desktop_options.settle = false;
+	linux_desktop_options.io_uring = false;
+
+	LinuxDesktopRing *ring = nullptr;
+	if (io_uring && !(ring = create_linux_desktop_ring(DEVICE_COUNT))) {
+		std::fprintf(stderr, "%s: io_uring not available\n", group.c_str());
+		linux_desktop_options = saved_options;
+		return;
+	}
+	std::vector<MockUinput> mocks(DEVICE_COUNT / 2);
+	std::vector<Desktop *> desktops;
+	for (auto &mock : mocks) {
+		const auto [fd_a, fd_b] = mock.take_fds();
+		desktops.push_back(connect_linux_desktop(fd_a, -1, ring));
+		desktops.push_back(connect_linux_desktop(fd_b, -1, ring));
+	}
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	for (auto &mock : mocks)
+		mock.reset_counters();
+	const auto rounds = std::max(n / DEVICE_COUNT, std::size_t(1));
+	const auto t = measure([&] {
+		for (std::size_t i = 0; i < rounds; i++) {
+			for (const auto desktop : desktops) {
+				desktop->key(Desktop::Key::a, Press);
+				desktop->key(Desktop::Key::a, Release);
+				desktop->flush();
+			}
+			if (ring)
+				linux_desktop_ring_submit(*ring);
+		}
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+	double writes = 0, events = 0;
+	for (const auto &mock : mocks) {
+		writes += double(mock.writes());
+		events += double(mock.events());
+	}
+	const auto actions = double(rounds * DEVICE_COUNT);
+	report(group + "/key", {
+		{"actions", actions},
+		{"writes/action", writes / actions},
+		{"events/s", events / t.seconds},
+		{"cpu-ns/event", events ? t.cpu_seconds * 1e9 / events : 0.0},
+	});
+
+	for (const auto desktop : desktops)
+		disconnect_desktop(desktop);
+	for (auto &mock : mocks)
+		mock.join();
+	destroy_linux_desktop_ring(ring);
+	linux_desktop_options = saved_options;
+}
+
+static void print_usage(const char *program) {
+	std::fprintf(stderr, "usage: %s [--jsonl] [--baseline FILE] [ACTIONS]\n", program);
+}
+
+int main(int argc, char *argv[]) {
+	std::size_t n = 100'000;
+	for (int i = 1; i < argc; i++) {
+		if (!std::strcmp(argv[i], "--jsonl")) {
+			jsonl_output = true;
+		} else if (!std::strcmp(argv[i], "--baseline") && i + 1 < argc) {
+			load_baseline(argv[++i]);
+		} else if (argv[i][0] != '-' && (n = std::strtoul(argv[i], nullptr, 10))) {
+			continue;
+		} else {
+			print_usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	bench_compiler();
+	bench_player(false);
+	bench_player(true);
+	bench_image_search();
+	bench_test_desktop(n);
+#if VINPUT_DESKTOP_X11 || VINPUT_DESKTOP_XCB
+	bench_xvfb(n);
+#endif // VINPUT_DESKTOP_X11 || VINPUT_DESKTOP_XCB
+	for (const bool io_uring : {false, true}) {
+		bench_uinput(n, false, io_uring);
+		bench_uinput(n, true, io_uring);
+		bench_uinput_load(n, io_uring);
+	}
+}
@@ -0,0 +1,37 @@
+# Build vinput with profile-guided optimization and report the speedup:
+#   cmake [-DBUILD_DIR=...] [-DARGS="-DCMAKE_CXX_COMPILER=clang++;..."] -P cmake/pgo.cmake
+# A plain build and a PGO build are made in BUILD_DIR (default: build-pgo),
+# and `vinput_bench` results of both are compared. Requires the linux back end.
+
+cmake_minimum_required(VERSION 3.16)
+
+get_filename_component(source_dir "${CMAKE_CURRENT_LIST_DIR}/.." ABSOLUTE)
+if(NOT BUILD_DIR)
+	set(BUILD_DIR "${source_dir}/build-pgo")
+endif()
+set(common_args -DCMAKE_BUILD_TYPE=Release -DVINPUT_BUILD_BENCH=ON ${ARGS})
+
+function(run)
+	execute_process(COMMAND ${ARGN} RESULT_VARIABLE result)
+	if(NOT result EQUAL 0)
+		message(FATAL_ERROR "Failed (${result}): ${ARGN}")
+	endif()
+endfunction()
+
+function(configure_and_build dir)
+	run(${CMAKE_COMMAND} -S "${source_dir}" -B "${dir}" ${common_args} ${ARGN})
+	run(${CMAKE_COMMAND} --build "${dir}" --parallel)
+endfunction()
+
+message(STATUS "Plain build")
+configure_and_build("${BUILD_DIR}/base" -DVINPUT_PGO=OFF)
+message(STATUS "Instrumented build")
+configure_and_build("${BUILD_DIR}/pgo" -DVINPUT_PGO=GENERATE)
+run(${CMAKE_COMMAND} --build "${BUILD_DIR}/pgo" --target pgo_train)
+message(STATUS "Optimized build")
+configure_and_build("${BUILD_DIR}/pgo" -DVINPUT_PGO=USE)
+
+message(STATUS "Benchmarking the plain build")
+run("${BUILD_DIR}/base/vinput_bench" --jsonl OUTPUT_FILE "${BUILD_DIR}/base.jsonl")
+message(STATUS "Benchmarking the optimized build, with speedups over the plain one")
+run("${BUILD_DIR}/pgo/vinput_bench" --baseline "${BUILD_DIR}/base.jsonl")
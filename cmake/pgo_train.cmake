@@ -0,0 +1,78 @@
+# Training workload of profile-guided optimization. Run by target `pgo_train`:
+#   cmake -DVINPUT=... [-DVINPUT_BENCH=...] -DWORK_DIR=... -DCOMPILER=...
+#         [-DLLVM_PROFDATA=...] -P pgo_train.cmake
+# Scripts are played on the test and null desktops, which need no display.
+
+cmake_minimum_required(VERSION 3.16)
+
+file(MAKE_DIRECTORY "${WORK_DIR}")
+if(COMPILER MATCHES "Clang")
+	file(GLOB old_profiles "${WORK_DIR}/*.profraw")
+	if(old_profiles)
+		file(REMOVE ${old_profiles})
+	endif()
+	set(ENV{LLVM_PROFILE_FILE} "${WORK_DIR}/%p-%m.profraw")
+endif()
+
+# Compile-heavy: prose, where every character is a key.
+set(text "")
+foreach(i RANGE 4095)
+	string(APPEND text "The quick brown fox, jumps over 13 lazy dogs! ")
+endforeach()
+file(WRITE "${WORK_DIR}/text.vinput" "${text}")
+
+# Compile-heavy: commands of each kind.
+set(commands "")
+foreach(i RANGE 999)
+	string(APPEND commands
+		"\\[$ESCAPE]\\[$SHIFT_L,v]x\\[$SHIFT_L,^]\\[#0.05]\\<\\>\\|\\[%LEFT,v]\\[%LEFT,^]"
+		"\\[{3]ab\\}\\[=title:train]\\[=]\\n\\t\\s\\\\\\[@1920,1080]\\[|v,2,0.1]")
+endforeach()
+file(WRITE "${WORK_DIR}/commands.vinput" "${commands}")
+
+# Dispatch-heavy: loops of loops.
+file(WRITE "${WORK_DIR}/loops.vinput" "\\[{1000]\\[{1000]a\\[@10,20]\\}\\}")
+
+function(vinput_train)
+	execute_process(COMMAND "${VINPUT}" ${ARGN} RESULT_VARIABLE result OUTPUT_QUIET)
+	if(NOT result EQUAL 0)
+		message(FATAL_ERROR "Training run failed (${result}): vinput ${ARGN}")
+	endif()
+endfunction()
+
+foreach(script IN ITEMS text commands loops)
+	set(path "${WORK_DIR}/${script}.vinput")
+	message(STATUS "Training: ${script}")
+	vinput_train(--desktop null "${path}")
+	vinput_train(--desktop count "${path}")
+	foreach(format IN ITEMS text jsonl)
+		vinput_train("--test=${format}:${WORK_DIR}/${script}.${format}" "${path}")
+	endforeach()
+	vinput_train("--test=binary:${WORK_DIR}/${script}.bin" "${path}")
+	vinput_train(--verify "${WORK_DIR}/${script}.bin" "${path}")
+	file(REMOVE
+		"${WORK_DIR}/${script}.text" "${WORK_DIR}/${script}.jsonl" "${WORK_DIR}/${script}.bin")
+endforeach()
+
+# Back end-heavy, including uinput on a mock, if the benchmark is built.
+if(VINPUT_BENCH)
+	message(STATUS "Training: vinput_bench")
+	execute_process(COMMAND "${VINPUT_BENCH}" 20000 RESULT_VARIABLE result OUTPUT_QUIET)
+	if(NOT result EQUAL 0)
+		message(FATAL_ERROR "Training run failed (${result}): vinput_bench")
+	endif()
+endif()
+
+if(COMPILER MATCHES "Clang")
+	if(NOT LLVM_PROFDATA)
+		message(FATAL_ERROR "llvm-profdata is required to merge Clang profiles")
+	endif()
+	file(GLOB profiles "${WORK_DIR}/*.profraw")
+	execute_process(
+		COMMAND "${LLVM_PROFDATA}" merge -output "${WORK_DIR}/vinput.profdata" ${profiles}
+		RESULT_VARIABLE result
+	)
+	if(NOT result EQUAL 0)
+		message(FATAL_ERROR "Cannot merge profiles")
+	endif()
+endif()
@@ -0,0 +1,433 @@
+#ifndef _WIN32
+
+#include "daemon.h"
+
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <sstream>
+#include <system_error>
+#include <thread>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "prints.h"
+#include "script.h"
+
+using namespace vinput;
+
+/*
+ * Protocol. A client connects, sends one request and waits for the reply.
+ *
+ * request = RequestHeader payload ;
+ * reply   = ReplyHeader message ;
+ *
+ * The payload is either script source text or bytecode written by
+ * `Script::save()`. The message is empty if the job succeeded.
+ */
+
+namespace {
+
+#pragma pack(push, 1)
+
+struct RequestHeader {
+	enum Kind : std::uint8_t { TEXT, BYTECODE };
+
+	char magic[4];
+	Kind kind;
+	std::uint8_t _reserved[3];
+	std::uint32_t size;
+};
+
+struct ReplyHeader {
+	enum Status : std::uint8_t { OK, SYNTAX_ERROR, RUNTIME_ERROR, PROTOCOL_ERROR };
+
+	Status status;
+	std::uint8_t _reserved[3];
+	std::uint32_t size;
+};
+
+#pragma pack(pop)
+
+constexpr char request_magic[4] = {'V', 'I', 'N', 'P'};
+constexpr std::uint32_t request_size_limit = 64 << 20;
+constexpr int request_timeout_sec = 5; // Of each read of a request.
+
+struct Job {
+	int client_fd;
+	Script script;
+};
+
+// Jobs in the order their requests were accepted. A place is reserved when
+// a request is accepted and filled when it has been received, so that a long
+// request is not overtaken by later short ones.
+class JobQueue {
+public:
+	// Reserve the place of the next job. Returns false if closed.
+	bool reserve(std::uint64_t &ticket);
+	// Fill the reserved place. Returns false, leaving the job, if closed.
+	bool fill(std::uint64_t ticket, Job &&job);
+	// Give up the reserved place, as the request has failed.
+	void cancel(std::uint64_t ticket) noexcept;
+	bool pop(Job &job);
+	// Returns the received jobs not popped yet.
+	std::deque<Job> close() noexcept;
+
+private:
+	struct Place {
+		std::optional<Job> job;
+		bool done = false; // Filled or cancelled.
+	};
+
+	std::mutex mutex;
+	std::condition_variable cond;
+	std::deque<Place> places;
+	std::uint64_t first_ticket = 0; // Of places.front().
+	bool closed = false;
+
+	void finish(std::uint64_t ticket, std::optional<Job> &&job);
+};
+
+// Requests being received, each on its own thread so that a slow client
+// does not hold up the others.
+class Receivers {
+public:
+	void start(int client_fd, JobQueue &queue) noexcept;
+	// Wait until all are done.
+	void join() noexcept;
+
+private:
+	std::mutex mutex;
+	std::condition_variable cond;
+	unsigned int count = 0;
+};
+
+}
+
+bool JobQueue::reserve(std::uint64_t &ticket) {
+	std::lock_guard lock(this->mutex);
+	if (this->closed)
+		return false;
+	ticket = this->first_ticket + this->places.size();
+	this->places.emplace_back();
+	return true;
+}
+
+bool JobQueue::fill(std::uint64_t ticket, Job &&job) {
+	{
+		std::lock_guard lock(this->mutex);
+		if (this->closed)
+			return false;
+		this->finish(ticket, std::move(job));
+	}
+	this->cond.notify_one();
+	return true;
+}
+
+void JobQueue::cancel(std::uint64_t ticket) noexcept {
+	{
+		std::lock_guard lock(this->mutex);
+		if (this->closed)
+			return;
+		this->finish(ticket, std::nullopt);
+	}
+	this->cond.notify_one();
+}
+
+void JobQueue::finish(std::uint64_t ticket, std::optional<Job> &&job) {
+	auto &place = this->places[std::size_t(ticket - this->first_ticket)];
+	place.job = std::move(job);
+	place.done = true;
+}
+
+bool JobQueue::pop(Job &job) {
+	std::unique_lock lock(this->mutex);
+	while (true) {
+		this->cond.wait(lock, [this] {
+			return this->closed || (!this->places.empty() && this->places.front().done);
+		});
+		if (this->closed)
+			return false;
+		auto place = std::move(this->places.front());
+		this->places.pop_front();
+		this->first_ticket++;
+		if (place.job) {
+			job = std::move(*place.job);
+			return true;
+		}
+	}
+}
+
+std::deque<Job> JobQueue::close() noexcept {
+	std::deque<Job> rest;
+	{
+		std::lock_guard lock(this->mutex);
+		this->closed = true;
+		for (auto &place : this->places) {
+			if (place.job)
+				rest.push_back(std::move(*place.job));
+		}
+		this->places.clear();
+	}
+	this->cond.notify_all();
+	return rest;
+}
+
+static std::atomic_bool daemon_stop_flag = false;
+
+static bool read_full(int fd, void *buffer, std::size_t size) noexcept {
+	for (auto p = static_cast<char *>(buffer); size; ) {
+		const auto n = read(fd, p, size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		size -= std::size_t(n);
+	}
+	return true;
+}
+
+static bool write_full(int fd, const void *buffer, std::size_t size) noexcept {
+	for (auto p = static_cast<const char *>(buffer); size; ) {
+		const auto n = write(fd, p, size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		size -= std::size_t(n);
+	}
+	return true;
+}
+
+static void send_reply(
+		int fd, ReplyHeader::Status status, const char *message) noexcept {
+	ReplyHeader header;
+	std::memset(&header, 0, sizeof header);
+	header.status = status;
+	header.size = std::uint32_t(message ? std::strlen(message) : 0);
+	if (write_full(fd, &header, sizeof header) && header.size)
+		write_full(fd, message, header.size);
+	close(fd);
+}
+
+static sockaddr_un make_socket_address(const char *socket_path) {
+	sockaddr_un addr;
+	std::memset(&addr, 0, sizeof addr);
+	addr.sun_family = AF_UNIX;
+	if (std::strlen(socket_path) >= sizeof addr.sun_path)
+		throw std::system_error(ENAMETOOLONG, std::generic_category(), socket_path);
+	std::strcpy(addr.sun_path, socket_path);
+	return addr;
+}
+
+// Read a request and compile it. Returns false if the reply has been sent.
+static bool receive_job(int client_fd, Job &job) noexcept {
+	RequestHeader header;
+	if (!read_full(client_fd, &header, sizeof header) ||
+			std::memcmp(header.magic, request_magic, sizeof request_magic) ||
+			header.size > request_size_limit) {
+		send_reply(client_fd, ReplyHeader::PROTOCOL_ERROR, "bad request");
+		return false;
+	}
+	std::string payload(header.size, '\0');
+	if (!read_full(client_fd, payload.data(), payload.size())) {
+		send_reply(client_fd, ReplyHeader::PROTOCOL_ERROR, "truncated request");
+		return false;
+	}
+
+	try {
+		std::istringstream source(std::move(payload));
+		if (header.kind == RequestHeader::BYTECODE)
+			job.script.load(source);
+		else
+			job.script.append(source);
+	} catch (const ScriptSyntaxError &e) {
+		send_reply(client_fd, ReplyHeader::SYNTAX_ERROR, e.what());
+		return false;
+	} catch (const std::exception &e) {
+		send_reply(client_fd, ReplyHeader::PROTOCOL_ERROR, e.what());
+		return false;
+	}
+	job.client_fd = client_fd;
+	return true;
+}
+
+void Receivers::start(int client_fd, JobQueue &queue) noexcept {
+	// The place in the queue is taken now, in the order of accepting.
+	std::uint64_t ticket;
+	if (!queue.reserve(ticket)) {
+		send_reply(client_fd, ReplyHeader::RUNTIME_ERROR, "daemon stopped");
+		return;
+	}
+	{
+		std::lock_guard lock(this->mutex);
+		this->count++;
+	}
+	const auto receive = [this, client_fd, ticket, &queue] {
+		Job job;
+		if (!receive_job(client_fd, job))
+			queue.cancel(ticket);
+		else if (!queue.fill(ticket, std::move(job)))
+			send_reply(client_fd, ReplyHeader::RUNTIME_ERROR, "daemon stopped");
+		// Notified while locked, so that join() cannot return before.
+		std::lock_guard lock(this->mutex);
+		this->count--;
+		this->cond.notify_all();
+	};
+	try {
+		std::thread(receive).detach();
+	} catch (const std::system_error &) {
+		receive();
+	}
+}
+
+void Receivers::join() noexcept {
+	std::unique_lock lock(this->mutex);
+	this->cond.wait(lock, [this] { return !this->count; });
+}
+
+static void play_jobs(JobQueue &queue, Desktop &desktop) noexcept {
+	Job job;
+	while (queue.pop(job)) {
+		try {
+			job.script.play(desktop, &daemon_stop_flag);
+		} catch (const std::exception &e) {
+			send_reply(job.client_fd, ReplyHeader::RUNTIME_ERROR, e.what());
+			continue;
+		}
+		if (daemon_stop_flag)
+			send_reply(job.client_fd, ReplyHeader::RUNTIME_ERROR, "daemon stopped");
+		else
+			send_reply(job.client_fd, ReplyHeader::OK, nullptr);
+	}
+}
+
+// Try connecting to the socket, to see whether a daemon is listening.
+// Returns 0 if connected, or the error.
+static int probe_socket(const sockaddr_un &addr) noexcept {
+	const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+		return errno;
+	const int err =
+		connect(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof addr) ? errno : 0;
+	close(fd);
+	return err;
+}
+
+std::string vinput::daemon_socket_path() {
+	if (const auto dir = std::getenv("XDG_RUNTIME_DIR"); dir && *dir)
+		return std::string(dir) + "/vinput.sock";
+	return "/tmp/vinput-" + std::to_string(getuid()) + ".sock";
+}
+
+void vinput::run_daemon(Desktop &desktop, const char *socket_path) {
+	const auto addr = make_socket_address(socket_path);
+	const int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listen_fd == -1)
+		throw std::system_error(errno, std::generic_category(), "socket");
+	switch (probe_socket(addr)) {
+	case 0:
+		close(listen_fd);
+		throw std::system_error(
+			EADDRINUSE, std::generic_category(), std::string(socket_path) + ": already running");
+	case ECONNREFUSED:
+		// Left by a daemon that did not exit normally.
+		unlink(socket_path);
+		break;
+	default:
+		break;
+	}
+	if (bind(listen_fd, reinterpret_cast<const sockaddr *>(&addr), sizeof addr) ||
+			listen(listen_fd, SOMAXCONN)) {
+		const auto err = errno;
+		close(listen_fd);
+		throw std::system_error(err, std::generic_category(), socket_path);
+	}
+
+	daemon_stop_flag = false;
+	std::signal(SIGTERM, [](int) { daemon_stop_flag = true; });
+	std::signal(SIGHUP, [](int) { daemon_stop_flag = true; });
+	std::signal(SIGPIPE, SIG_IGN);
+
+	JobQueue queue;
+	Receivers receivers;
+	std::thread player(play_jobs, std::ref(queue), std::ref(desktop));
+
+	pollfd pfd = {.fd = listen_fd, .events = POLLIN, .revents = 0};
+	const timeval timeout = {.tv_sec = request_timeout_sec, .tv_usec = 0};
+	while (!daemon_stop_flag) {
+		if (poll(&pfd, 1, 500) <= 0)
+			continue;
+		const int client_fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+		if (client_fd == -1)
+			continue;
+		setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+		receivers.start(client_fd, queue);
+	}
+
+	// The script being played stops at the flag; the queued ones are dropped.
+	for (const auto &job : queue.close())
+		send_reply(job.client_fd, ReplyHeader::RUNTIME_ERROR, "daemon stopped");
+	player.join();
+	receivers.join();
+	close(listen_fd);
+	unlink(socket_path);
+	std::signal(SIGTERM, SIG_DFL);
+	std::signal(SIGHUP, SIG_DFL);
+}
+
+bool vinput::run_client(const Script &script, const char *socket_path) {
+	std::ostringstream bytecode;
+	script.save(bytecode);
+	const auto payload = std::move(bytecode).str();
+
+	const auto addr = make_socket_address(socket_path);
+	const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+		throw std::system_error(errno, std::generic_category(), "socket");
+	if (connect(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof addr)) {
+		const auto err = errno;
+		close(fd);
+		throw std::system_error(err, std::generic_category(), socket_path);
+	}
+
+	RequestHeader request;
+	std::memset(&request, 0, sizeof request);
+	std::memcpy(request.magic, request_magic, sizeof request_magic);
+	request.kind = RequestHeader::BYTECODE;
+	request.size = std::uint32_t(payload.size());
+	ReplyHeader reply;
+	const bool ok =
+		write_full(fd, &request, sizeof request) &&
+		write_full(fd, payload.data(), payload.size()) &&
+		read_full(fd, &reply, sizeof reply);
+	if (!ok) {
+		close(fd);
+		throw std::system_error(EPROTO, std::generic_category(), "daemon");
+	}
+	std::string message(reply.size, '\0');
+	read_full(fd, message.data(), message.size());
+	close(fd);
+
+	if (reply.status != ReplyHeader::OK) {
+		cerr() << "vinput: error: " << message << std::endl;
+		return false;
+	}
+	return true;
+}
+
+#endif // !_WIN32
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <string>
+
+namespace vinput {
+
+class Desktop;
+class Script;
+
+// Default path of the daemon socket.
+std::string daemon_socket_path();
+
+// Listen on the UNIX domain socket and play submitted scripts one by one
+// (first come, first served, in the order the connections are accepted) on
+// the connected desktop. Does not return until
+// SIGTERM or SIGHUP is received, which stops the script being played and
+// drops the queued ones. Fails if a daemon is already listening on the socket.
+void run_daemon(Desktop &desktop, const char *socket_path);
+
+// Submit the script to the daemon and wait until it has been played.
+// Returns whether the job succeeded; the error message is printed otherwise.
+bool run_client(const Script &script, const char *socket_path);
+
+}
@@ -1,13 +1,10 @@
 #include "desktop.h"
 
-#include <cstdlib>
 #include <cstring>
 #include <unordered_map>
 
 using namespace vinput;
 
-static Desktop *desktop_instance = nullptr;
-
 #pragma pack(push, 1)
 
 static const char *key_names[] = {
@@ -181,15 +178,33 @@ std::string_view Desktop::button_to_name(Button button) noexcept {
 }
 
 Desktop::Desktop() noexcept {
-	if (desktop_instance)
-		std::abort();
-	desktop_instance = this;
 }
 
 Desktop::~Desktop() {
-	if (desktop_instance != this)
-		std::abort();
-	desktop_instance = nullptr;
+}
+
+void Desktop::sync() {
+	this->flush();
+}
+
+void Desktop::target(std::string_view spec) {
+	if (!spec.empty())
+		throw DesktopBaseError("vinput", "targeting windows is not supported by the desktop");
+}
+
+bool Desktop::simulated_time() const noexcept {
+	return false;
+}
+
+void Desktop::pass_time(unsigned int) noexcept {
+}
+
+Desktop::ScreenArea Desktop::screen_area() const {
+	return {0, 0, 0, 0};
+}
+
+bool Desktop::capture(ScreenArea, std::uint32_t *) {
+	throw DesktopBaseError("vinput", "screen capture is not supported by the desktop");
 }
 
 DesktopBaseError::DesktopBaseError(const char *name, const char *msg) noexcept {
@@ -243,3 +258,7 @@ const char *DesktopBaseError::what() const noexcept {
 DesktopUnavailabeError::DesktopUnavailabeError(const char *desktop_name) noexcept
 		: DesktopBaseError(desktop_name, "not available") {
 }
+
+TraceDivergedError::TraceDivergedError(const char *message) noexcept
+		: DesktopBaseError("verify", message) {
+}
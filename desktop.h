@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <exception>
 #include <string_view>
 #include <utility>
@@ -47,6 +48,14 @@ public:
 		unsigned int x, y;
 	};
 
+	// Rectangle on the screen.
+	struct ScreenArea {
+		unsigned int x, y, width, height;
+	};
+
+	// Scroll distance of one wheel notch.
+	static constexpr int SCROLL_NOTCH = 120;
+
 	static std::pair<Key, bool> key_from_name(std::string_view name) noexcept;
 	static std::string_view key_to_name(Key key) noexcept;
 	static std::pair<Button, bool> button_from_name(std::string_view name) noexcept;
@@ -66,18 +75,38 @@ public:
 	virtual void key(Key k, PressAction a) = 0;
 	// Send button event.
 	virtual void button(Button b, PressAction a) = 0;
+	// Send wheel scroll event. Distances are in 1/SCROLL_NOTCH of a notch;
+	// positive values scroll right / up.
+	virtual void scroll(int dx, int dy) = 0;
 	// Send pointer movement event.
 	virtual void pointer(PointerPosition pos) = 0;
 	// Get current pointer position
 	virtual PointerPosition pointer() const = 0;
 	// Immediately handle the events in the queue.
 	virtual void flush() = 0;
+	// Flush, and wait until the receiver has handled the events. Only flushes
+	// by default.
+	virtual void sync();
+	// Send key events to the window described by `spec` instead of the focused
+	// one; an empty `spec` restores the default. Not supported by default.
+	virtual void target(std::string_view spec);
+	// Check whether the desktop runs on a simulated clock. If so, the player
+	// calls pass_time() instead of sleeping. False by default.
+	virtual bool simulated_time() const noexcept;
+	// Advance the simulated clock.
+	virtual void pass_time(unsigned int time_ms) noexcept;
+	// Get the area of the whole screen. Empty by default.
+	virtual ScreenArea screen_area() const;
+	// Copy pixels of the screen area to `pixels`, row by row, as 0x00RRGGBB.
+	// Returns false if the desktop has no screen, as those for testing.
+	// Not supported by default.
+	virtual bool capture(ScreenArea area, std::uint32_t *pixels);
 
 	operator bool() const noexcept { return ready(); }
 };
 
 // Base desktop error.
-class DesktopBaseError : std::exception {
+class DesktopBaseError : public std::exception {
 public:
 	DesktopBaseError(const char *desktop_name, const char *message) noexcept;
 	DesktopBaseError(DesktopBaseError &&) noexcept;
@@ -94,9 +123,15 @@ protected:
 };
 
 // Error: desktop not available.
-class DesktopUnavailabeError : DesktopBaseError {
+class DesktopUnavailabeError : public DesktopBaseError {
 public:
 	DesktopUnavailabeError(const char *desktop_name) noexcept;
 };
 
+// Error: events differ from the expected ones.
+class TraceDivergedError : public DesktopBaseError {
+public:
+	TraceDivergedError(const char *message) noexcept;
+};
+
 }
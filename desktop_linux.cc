@@ -1,21 +1,69 @@
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
 #include <climits>
+#include <cstdint>
 #include <cstring>
+#include <memory>
+#include <utility>
+#include <vector>
 
 #include "desktop.h"
+#include "desktops.h"
 #include "desktops_def.h"
 #include "prints.h"
 
 #include <fcntl.h>
+#include <linux/io_uring.h>
 #include <linux/uinput.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
 using namespace vinput;
 
 namespace {
 
+// Minimal io_uring submission and completion queues, without liburing.
+class IoUring {
+public:
+	explicit IoUring(unsigned entries) noexcept;
+	~IoUring();
+
+	IoUring(const IoUring &) = delete;
+	IoUring &operator=(const IoUring &) = delete;
+
+	// Check whether io_uring is supported by the kernel and set up, with
+	// the operations used here.
+	bool ready() const noexcept { return this->fd >= 0; }
+	// Get a cleared submission queue entry. Returns null if the queue is full.
+	struct io_uring_sqe *get_sqe() noexcept;
+	// Submit new entries and wait for at least `wait_nr` completions.
+	int enter(unsigned wait_nr) noexcept;
+	// Consume available completions. Returns the number of them.
+	template <typename Func> unsigned reap(Func &&func) noexcept;
+
+private:
+	int fd;
+	void *sq_ring, *cq_ring;
+	std::size_t sq_ring_size, cq_ring_size;
+	struct io_uring_sqe *sqes;
+	std::size_t sqes_size;
+	unsigned *sq_head, *sq_tail, *sq_array, sq_mask, sq_entries;
+	unsigned *cq_head, *cq_tail, cq_mask;
+	struct io_uring_cqe *cqes;
+	unsigned sqe_tail, sqe_submitted;
+
+	bool supports(unsigned opcode) const noexcept;
+	void release() noexcept;
+};
+
 class LinuxUinputDesktop : public Desktop {
 public:
 	LinuxUinputDesktop();
+	LinuxUinputDesktop(int fd_keyboard, int fd_mouse, LinuxDesktopRing *ring = nullptr);
 	~LinuxUinputDesktop();
 
 	LinuxUinputDesktop(LinuxUinputDesktop &&) = delete;
@@ -26,10 +74,16 @@ public:
 	virtual bool ready() const noexcept override;
 	virtual void key(Key k, PressAction a) override;
 	virtual void button(Button b, PressAction a) override;
+	virtual void scroll(int dx, int dy) override;
 	virtual void pointer(PointerPosition pos) override;
 	virtual PointerPosition pointer() const override;
 	virtual void flush() override;
 
+	LinuxDesktopStats stats() const noexcept;
+
+	// Write queued events of all desktops on the ring, and wait for them.
+	static void drain_uring(LinuxDesktopRing &ring) noexcept;
+
 private:
 	static constexpr auto KEY_COUNT = std::size_t(Key::_COUNT);
 	static constexpr auto BUTTON_COUNT = std::size_t(Button::_COUNT);
@@ -37,51 +91,312 @@ private:
 	static const int key_code_map[KEY_COUNT];
 	static const int btn_code_map[BUTTON_COUNT];
 
-	static void create_uinput_keyboard_dev(int fd) noexcept;
-	static void create_uinput_mouse_dev(int fd) noexcept;
+	// A uinput device and its output queue. Events that cannot be written at
+	// once (EAGAIN) are queued and retried when the device becomes writable.
+	// With io_uring, all events are queued and submitted when the ring is
+	// drained, together with those of other devices on it.
+	class Device {
+	public:
+		explicit Device(int fd) noexcept : fd(fd) { }
+
+		// Write events or queue them. Blocks if the queue is too long.
+		void write(const struct input_event *events, std::size_t count) noexcept;
+		// Wait until all queued events are written or dropped.
+		void drain() noexcept;
+
+		int fd;
+		LinuxDesktopRing *ring = nullptr;
+		LinuxDesktopStats stats = { };
+
+	private:
+		friend class LinuxUinputDesktop;
+
+		static constexpr std::size_t QUEUE_LIMIT = 1024;
+		static constexpr int POLL_TIMEOUT_MS = 1000;
+
+		std::vector<struct input_event> queue;
+		std::size_t queue_head = 0;
+		bool uring_busy = false;
+
+		bool pending() const noexcept { return this->queue_head < this->queue.size(); }
+		std::size_t write_some(const struct input_event *events, std::size_t count) noexcept;
+		bool wait_writable() noexcept;
+		void drop_queue() noexcept;
+		bool uring_prepare() noexcept;
+		void uring_complete(int result) noexcept;
+	};
+
+	// Events of one action, which are submitted with a single syscall.
+	class EventBatch {
+	public:
+		void emit(int type, int code, int value) noexcept;
+		void syn_report() noexcept;
+		void submit(Device &dev) noexcept;
+
+	private:
+		static constexpr std::size_t CAPACITY = 8;
+		struct input_event events[CAPACITY];
+		std::size_t count = 0;
+	};
+
+	static void set_keyboard_bits(int fd) noexcept;
+	static void set_mouse_bits(int fd, PointerPosition screen_size) noexcept;
+	static void create_uinput_dev(int fd, const char *name, int product) noexcept;
 	static void destroy_uinput_dev(int fd) noexcept;
 
-	static void emit(int fd, int type, int code, int value) noexcept;
-	static void event_syn_report(int fd) noexcept;
+	std::unique_ptr<LinuxDesktopRing> own_ring; // Used if no ring is given.
+	LinuxDesktopRing *ring = nullptr;
+	// Keyboard and mouse devices, or only one composite device.
+	Device devices[2];
+	std::size_t device_count;
+	PointerPosition screen_size; // Absolute positioning if not zero.
+	PointerPosition pointer_position;
+	bool settle;
+	int scroll_rest_x = 0, scroll_rest_y = 0; // Distances less than a notch.
 
-	int fd_keyboard, fd_mouse;
+	Device &keyboard_dev() noexcept { return this->devices[0]; }
+	Device &mouse_dev() noexcept { return this->devices[this->device_count - 1]; }
 
 	void keyboard_key(Key k, bool press) noexcept;
 	void mouse_button(Button b, bool press) noexcept;
 	void mouse_wheel(Button b) noexcept;
+	void mouse_scroll(int dx, int dy) noexcept;
 	void mouse_goto(PointerPosition pos) noexcept;
 };
 
 }
 
+// Desktops sharing an io_uring, in the order their devices are submitted.
+struct vinput::LinuxDesktopRing {
+	explicit LinuxDesktopRing(unsigned entries) noexcept : uring(entries) { }
+
+	IoUring uring;
+	std::vector<LinuxUinputDesktop *> desktops;
+};
+
+IoUring::IoUring(unsigned entries) noexcept
+		: sq_ring(MAP_FAILED), cq_ring(MAP_FAILED), sqes(nullptr)
+		, sqe_tail(0), sqe_submitted(0) {
+	struct io_uring_params params;
+	bzero(&params, sizeof params);
+	this->fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+	if (this->fd < 0)
+		return;
+
+	this->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	this->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+	if (single_mmap)
+		this->sq_ring_size = this->cq_ring_size =
+			std::max(this->sq_ring_size, this->cq_ring_size);
+	this->sq_ring = mmap(
+		nullptr, this->sq_ring_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, this->fd, IORING_OFF_SQ_RING
+	);
+	this->cq_ring = single_mmap ? this->sq_ring : mmap(
+		nullptr, this->cq_ring_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, this->fd, IORING_OFF_CQ_RING
+	);
+	this->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	const auto sqes = mmap(
+		nullptr, this->sqes_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, this->fd, IORING_OFF_SQES
+	);
+	if (this->sq_ring == MAP_FAILED || this->cq_ring == MAP_FAILED || sqes == MAP_FAILED) {
+		if (sqes != MAP_FAILED)
+			munmap(sqes, this->sqes_size);
+		this->release();
+		return;
+	}
+	this->sqes = static_cast<struct io_uring_sqe *>(sqes);
+
+	const auto sq = static_cast<char *>(this->sq_ring);
+	this->sq_head = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+	this->sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+	this->sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+	this->sq_mask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+	this->sq_entries = params.sq_entries;
+	const auto cq = static_cast<char *>(this->cq_ring);
+	this->cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+	this->cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+	this->cq_mask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+	this->cqes = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+	this->sqe_tail = this->sqe_submitted = *this->sq_tail;
+
+	// IORING_OP_WRITE needs Linux 5.6. Older kernels fail every write.
+	if (!this->supports(IORING_OP_WRITE))
+		this->release();
+}
+
+IoUring::~IoUring() {
+	this->release();
+}
+
+struct io_uring_sqe *IoUring::get_sqe() noexcept {
+	const auto head = std::atomic_ref(*this->sq_head).load(std::memory_order_acquire);
+	if (this->sqe_tail - head >= this->sq_entries)
+		return nullptr;
+	const auto index = this->sqe_tail & this->sq_mask;
+	this->sqe_tail++;
+	this->sq_array[index] = index;
+	const auto sqe = &this->sqes[index];
+	bzero(sqe, sizeof *sqe);
+	return sqe;
+}
+
+int IoUring::enter(unsigned wait_nr) noexcept {
+	std::atomic_ref(*this->sq_tail).store(this->sqe_tail, std::memory_order_release);
+	const auto status = static_cast<int>(syscall(
+		__NR_io_uring_enter, this->fd, this->sqe_tail - this->sqe_submitted,
+		wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0, nullptr, 0
+	));
+	if (status > 0)
+		this->sqe_submitted += unsigned(status);
+	return status;
+}
+
+bool IoUring::supports(unsigned opcode) const noexcept {
+	constexpr unsigned OP_COUNT = 256;
+	alignas(struct io_uring_probe) unsigned char buffer[
+		sizeof(struct io_uring_probe) + OP_COUNT * sizeof(struct io_uring_probe_op)];
+	bzero(buffer, sizeof buffer);
+	const auto probe = reinterpret_cast<struct io_uring_probe *>(buffer);
+	// Probing is also new in Linux 5.6. Failing means no IORING_OP_WRITE.
+	if (syscall(__NR_io_uring_register, this->fd, IORING_REGISTER_PROBE, probe, OP_COUNT) < 0)
+		return false;
+	return opcode <= probe->last_op && (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED);
+}
+
+void IoUring::release() noexcept {
+	if (this->fd < 0)
+		return;
+	if (this->sqes)
+		munmap(this->sqes, this->sqes_size);
+	if (this->cq_ring != MAP_FAILED && this->cq_ring != this->sq_ring)
+		munmap(this->cq_ring, this->cq_ring_size);
+	if (this->sq_ring != MAP_FAILED)
+		munmap(this->sq_ring, this->sq_ring_size);
+	close(this->fd);
+	this->fd = -1;
+}
+
+template <typename Func> unsigned IoUring::reap(Func &&func) noexcept {
+	auto head = *this->cq_head;
+	const auto tail = std::atomic_ref(*this->cq_tail).load(std::memory_order_acquire);
+	const auto count = tail - head;
+	for (; head != tail; head++)
+		func(this->cqes[head & this->cq_mask]);
+	std::atomic_ref(*this->cq_head).store(head, std::memory_order_release);
+	return count;
+}
+
+LinuxDesktopOptions vinput::linux_desktop_options;
+
 VINPUT_DESKTOP_CONNECTER(linux) { return new LinuxUinputDesktop; }
 
+[[nodiscard]] Desktop *vinput::connect_linux_desktop(
+		int fd_keyboard, int fd_mouse, LinuxDesktopRing *ring) {
+	return new LinuxUinputDesktop(fd_keyboard, fd_mouse, ring);
+}
+
+[[nodiscard]] LinuxDesktopRing *vinput::create_linux_desktop_ring(unsigned int entries) {
+	auto ring = std::make_unique<LinuxDesktopRing>(entries);
+	if (!ring->uring.ready())
+		return nullptr;
+	return ring.release();
+}
+
+void vinput::destroy_linux_desktop_ring(LinuxDesktopRing *ring) noexcept {
+	assert(!ring || ring->desktops.empty());
+	delete ring;
+}
+
+void vinput::linux_desktop_ring_submit(LinuxDesktopRing &ring) noexcept {
+	LinuxUinputDesktop::drain_uring(ring);
+}
+
+LinuxDesktopStats vinput::linux_desktop_stats(const Desktop &desktop) noexcept {
+	const auto d = dynamic_cast<const LinuxUinputDesktop *>(&desktop);
+	if (!d)
+		return { };
+	return d->stats();
+}
+
 LinuxUinputDesktop::LinuxUinputDesktop()
-		: fd_keyboard(open("/dev/uinput", O_WRONLY | O_NONBLOCK))
-		, fd_mouse(open("/dev/uinput", O_WRONLY | O_NONBLOCK)) {
-	if (this->fd_keyboard == -1 || this->fd_mouse == -1) {
-		if (this->fd_keyboard != -1)
-			close(this->fd_keyboard);
-		if (this->fd_mouse != -1)
-			close(this->fd_mouse);
+		: LinuxUinputDesktop(
+			open("/dev/uinput", O_WRONLY | O_NONBLOCK),
+			linux_desktop_options.composite ? -1 : open("/dev/uinput", O_WRONLY | O_NONBLOCK)
+		) {
+}
+
+LinuxUinputDesktop::LinuxUinputDesktop(
+		int fd_keyboard, int fd_mouse, LinuxDesktopRing *ring)
+		: devices{Device(fd_keyboard), Device(fd_mouse)}
+		, device_count(linux_desktop_options.composite ? 1 : 2)
+		, screen_size{linux_desktop_options.screen_width, linux_desktop_options.screen_height}
+		, pointer_position{0, 0}
+		, settle(linux_desktop_options.settle) {
+	if (!this->screen_size.x || !this->screen_size.y)
+		this->screen_size = {0, 0};
+
+	if (this->device_count == 1 && fd_mouse != -1) {
+		close(fd_mouse);
+		fd_mouse = -1;
+	}
+	if (fd_keyboard == -1 || (fd_mouse == -1 && this->device_count == 2)) {
+		if (fd_keyboard != -1)
+			close(fd_keyboard);
+		if (fd_mouse != -1)
+			close(fd_mouse);
 		throw DesktopUnavailabeError("linux");
 	}
 
-	create_uinput_keyboard_dev(this->fd_keyboard);
-	create_uinput_mouse_dev(this->fd_mouse);
-	usleep(500'000);
+	if (!ring && linux_desktop_options.io_uring) {
+		this->own_ring = std::make_unique<LinuxDesktopRing>(8);
+		if (this->own_ring->uring.ready()) {
+			ring = this->own_ring.get();
+		} else {
+			print_warning("io_uring not available, fall back to write()");
+			this->own_ring.reset();
+		}
+	}
+	if (ring) {
+		this->ring = ring;
+		ring->desktops.push_back(this);
+		for (auto &dev : this->devices)
+			dev.ring = ring;
+	}
+
+	if (this->device_count == 1) {
+		set_keyboard_bits(fd_keyboard);
+		set_mouse_bits(fd_keyboard, this->screen_size);
+		create_uinput_dev(fd_keyboard, "vinput", 0x566b);
+	} else {
+		set_keyboard_bits(fd_keyboard);
+		create_uinput_dev(fd_keyboard, "vinput-keyboard", 0x5669);
+		set_mouse_bits(fd_mouse, this->screen_size);
+		create_uinput_dev(fd_mouse, "vinput-mouse", 0x566a);
+	}
+	if (this->settle)
+		usleep(LINUX_DESKTOP_SETTLE_MS * 1000);
 }
 
 LinuxUinputDesktop::~LinuxUinputDesktop() {
-	usleep(500'000);
-	if (this->fd_keyboard >= 0) {
-		destroy_uinput_dev(this->fd_keyboard);
-		close(this->fd_keyboard);
-	}
-	if (this->fd_mouse >= 0) {
-		destroy_uinput_dev(this->fd_mouse);
-		close(this->fd_mouse);
+	if (this->ring)
+		drain_uring(*this->ring);
+	else
+		this->flush();
+	if (const auto dropped = this->stats().dropped; dropped)
+		print_warning("%zu events dropped", dropped);
+	if (this->settle)
+		usleep(LINUX_DESKTOP_SETTLE_MS * 1000);
+	for (std::size_t i = 0; i < this->device_count; i++) {
+		const auto fd = this->devices[i].fd;
+		destroy_uinput_dev(fd);
+		close(fd);
 	}
+	if (this->ring)
+		std::erase(this->ring->desktops, this);
 }
 
 bool LinuxUinputDesktop::ready() const noexcept {
@@ -95,19 +410,43 @@ void LinuxUinputDesktop::key(Key k, PressAction a) {
 void LinuxUinputDesktop::button(Button b, PressAction a) {
 	if (static_cast<std::size_t>(b) <= static_cast<std::size_t>(Button::RIGHT))
 		this->mouse_button(b, a == PressAction::Press);
-	else
+	else if (a == PressAction::Press)
 		this->mouse_wheel(b);
 }
 
+void LinuxUinputDesktop::scroll(int dx, int dy) {
+	this->mouse_scroll(dx, dy);
+}
+
 void LinuxUinputDesktop::pointer(PointerPosition pos) {
 	this->mouse_goto(pos);
 }
 
 LinuxUinputDesktop::PointerPosition LinuxUinputDesktop::pointer() const {
-	return { 0, 0 };
+	// Only known with absolute positioning. (0, 0) otherwise.
+	return this->pointer_position;
 }
 
 void LinuxUinputDesktop::flush() {
+	// Events on a shared ring wait for linux_desktop_ring_submit().
+	if (this->ring) {
+		if (this->own_ring)
+			drain_uring(*this->ring);
+		return;
+	}
+	for (std::size_t i = 0; i < this->device_count; i++)
+		this->devices[i].drain();
+}
+
+LinuxDesktopStats LinuxUinputDesktop::stats() const noexcept {
+	LinuxDesktopStats result = { };
+	for (std::size_t i = 0; i < this->device_count; i++) {
+		const auto &stats = this->devices[i].stats;
+		result.written += stats.written;
+		result.retried += stats.retried;
+		result.dropped += stats.dropped;
+	}
+	return result;
 }
 
 const int LinuxUinputDesktop::key_code_map[KEY_COUNT] = {
@@ -237,41 +576,54 @@ const int LinuxUinputDesktop::btn_code_map[BUTTON_COUNT] = {
 	0,
 };
 
-void LinuxUinputDesktop::create_uinput_keyboard_dev(int fd) noexcept {
+void LinuxUinputDesktop::set_keyboard_bits(int fd) noexcept {
 	ioctl(fd, UI_SET_EVBIT, EV_KEY);
 	for (auto key_code : key_code_map) {
 		if (key_code == 0)
 			continue;
-		ioctl(fd, UI_SET_KEYBIT, key_code);
+		ioctl(fd, UI_SET_KEYBIT, key_code & ~KEY_NEED_SHIFT);
 	}
-
-	struct uinput_setup usetup;
-	bzero(&usetup, sizeof usetup);
-	usetup.id.bustype = BUS_USB;
-	usetup.id.vendor = 0x4867;
-	usetup.id.product = 0x5669;
-	std::strcpy(usetup.name, "vinput-keyboard");
-	ioctl(fd, UI_DEV_SETUP, &usetup);
-	ioctl(fd, UI_DEV_CREATE);
 }
 
-void LinuxUinputDesktop::create_uinput_mouse_dev(int fd) noexcept {
+void LinuxUinputDesktop::set_mouse_bits(
+		int fd, PointerPosition screen_size) noexcept {
 	ioctl(fd, UI_SET_EVBIT, EV_KEY);
 	ioctl(fd, UI_SET_KEYBIT, BTN_LEFT);
 	ioctl(fd, UI_SET_KEYBIT, BTN_MIDDLE);
 	ioctl(fd, UI_SET_KEYBIT, BTN_RIGHT);
 
 	ioctl(fd, UI_SET_EVBIT, EV_REL);
-	ioctl(fd, UI_SET_RELBIT, REL_X);
-	ioctl(fd, UI_SET_RELBIT, REL_Y);
 	ioctl(fd, UI_SET_RELBIT, REL_WHEEL);
+	ioctl(fd, UI_SET_RELBIT, REL_HWHEEL);
+	ioctl(fd, UI_SET_RELBIT, REL_WHEEL_HI_RES);
+	ioctl(fd, UI_SET_RELBIT, REL_HWHEEL_HI_RES);
+	if (screen_size.x) {
+		// Like a tablet, which is mapped to the whole screen without acceleration.
+		ioctl(fd, UI_SET_EVBIT, EV_ABS);
+		for (const auto &[code, size] : {
+				std::pair{ABS_X, screen_size.x}, std::pair{ABS_Y, screen_size.y}}) {
+			struct uinput_abs_setup abs_setup;
+			bzero(&abs_setup, sizeof abs_setup);
+			abs_setup.code = static_cast<decltype(abs_setup.code)>(code);
+			abs_setup.absinfo.minimum = 0;
+			abs_setup.absinfo.maximum = static_cast<int>(size - 1);
+			ioctl(fd, UI_SET_ABSBIT, code);
+			ioctl(fd, UI_ABS_SETUP, &abs_setup);
+		}
+	} else {
+		ioctl(fd, UI_SET_RELBIT, REL_X);
+		ioctl(fd, UI_SET_RELBIT, REL_Y);
+	}
+}
 
+void LinuxUinputDesktop::create_uinput_dev(
+		int fd, const char *name, int product) noexcept {
 	struct uinput_setup usetup;
 	bzero(&usetup, sizeof usetup);
 	usetup.id.bustype = BUS_USB;
 	usetup.id.vendor = 0x4867;
-	usetup.id.product = 0x566a;
-	std::strcpy(usetup.name, "vinput-mouse");
+	usetup.id.product = static_cast<decltype(usetup.id.product)>(product);
+	std::strcpy(usetup.name, name);
 	ioctl(fd, UI_DEV_SETUP, &usetup);
 	ioctl(fd, UI_DEV_CREATE);
 }
@@ -280,18 +632,166 @@ void LinuxUinputDesktop::destroy_uinput_dev(int fd) noexcept {
 	ioctl(fd, UI_DEV_DESTROY);
 }
 
-void LinuxUinputDesktop::emit(int fd, int type, int code, int value) noexcept {
-	struct input_event ie;
+void LinuxUinputDesktop::Device::write(
+		const struct input_event *events, std::size_t count) noexcept {
+	if (this->ring) {
+		this->queue.insert(this->queue.end(), events, events + count);
+		if (this->queue.size() - this->queue_head > QUEUE_LIMIT)
+			this->drain();
+		return;
+	}
+	if (!this->pending()) {
+		const auto n = this->write_some(events, count);
+		events += n;
+		count -= n;
+		if (!count)
+			return;
+	}
+	this->queue.insert(this->queue.end(), events, events + count);
+	this->stats.retried += count;
+	if (this->queue.size() - this->queue_head > QUEUE_LIMIT)
+		this->drain();
+}
+
+void LinuxUinputDesktop::Device::drain() noexcept {
+	if (this->ring) {
+		drain_uring(*this->ring);
+		return;
+	}
+	while (this->pending()) {
+		this->queue_head += this->write_some(
+			this->queue.data() + this->queue_head,
+			this->queue.size() - this->queue_head
+		);
+		if (!this->pending())
+			break;
+		if (!this->wait_writable()) {
+			this->drop_queue();
+			break;
+		}
+	}
+	this->queue.clear();
+	this->queue_head = 0;
+}
+
+std::size_t LinuxUinputDesktop::Device::write_some(
+		const struct input_event *events, std::size_t count) noexcept {
+	std::size_t written = 0;
+	while (written < count) {
+		const auto n = ::write(this->fd, events + written, (count - written) * sizeof *events);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			// Unrecoverable error. Give up the rest.
+			this->stats.dropped += count - written;
+			return count;
+		}
+		written += std::size_t(n) / sizeof *events;
+	}
+	this->stats.written += written;
+	return written;
+}
+
+bool LinuxUinputDesktop::Device::wait_writable() noexcept {
+	while (true) {
+		struct pollfd pfd = {.fd = this->fd, .events = POLLOUT, .revents = 0};
+		const auto status = poll(&pfd, 1, POLL_TIMEOUT_MS);
+		if (status < 0 && errno == EINTR)
+			continue;
+		return status > 0 && !(pfd.revents & (POLLERR | POLLHUP));
+	}
+}
+
+void LinuxUinputDesktop::Device::drop_queue() noexcept {
+	this->stats.dropped += this->queue.size() - this->queue_head;
+	this->queue_head = this->queue.size();
+}
+
+bool LinuxUinputDesktop::Device::uring_prepare() noexcept {
+	if (this->uring_busy || !this->pending())
+		return false;
+	const auto sqe = this->ring->uring.get_sqe();
+	if (!sqe)
+		return false;
+	sqe->opcode = IORING_OP_WRITE;
+	sqe->fd = this->fd;
+	sqe->addr = reinterpret_cast<std::uintptr_t>(this->queue.data() + this->queue_head);
+	sqe->len = static_cast<unsigned>(
+		(this->queue.size() - this->queue_head) * sizeof this->queue[0]);
+	sqe->off = std::uint64_t(-1); // Current file position, like write().
+	sqe->user_data = reinterpret_cast<std::uintptr_t>(this);
+	this->uring_busy = true;
+	return true;
+}
+
+void LinuxUinputDesktop::Device::uring_complete(int result) noexcept {
+	this->uring_busy = false;
+	if (result >= 0) {
+		const auto n = std::size_t(result) / sizeof this->queue[0];
+		this->queue_head += n;
+		this->stats.written += n;
+	} else if (result == -EAGAIN || result == -EINTR) {
+		this->stats.retried += this->queue.size() - this->queue_head;
+		if (!this->wait_writable())
+			this->drop_queue();
+	} else {
+		this->drop_queue();
+	}
+	if (!this->pending()) {
+		this->queue.clear();
+		this->queue_head = 0;
+	}
+}
+
+void LinuxUinputDesktop::drain_uring(LinuxDesktopRing &ring) noexcept {
+	const auto for_each_device = [&ring](auto &&func) {
+		for (const auto desktop : ring.desktops) {
+			for (std::size_t i = 0; i < desktop->device_count; i++)
+				func(desktop->devices[i]);
+		}
+	};
+
+	unsigned in_flight = 0;
+	while (true) {
+		for_each_device([&in_flight](Device &dev) { in_flight += dev.uring_prepare(); });
+		if (!in_flight)
+			break;
+		// Submit the writes of all devices, and wait for all of them at once.
+		if (ring.uring.enter(in_flight) < 0 && errno != EINTR) {
+			// Nothing can be submitted. Give up all.
+			for_each_device([](Device &dev) {
+				dev.uring_busy = false;
+				dev.drop_queue();
+			});
+			break;
+		}
+		in_flight -= ring.uring.reap([](const struct io_uring_cqe &cqe) {
+			reinterpret_cast<Device *>(cqe.user_data)->uring_complete(cqe.res);
+		});
+	}
+}
+
+void LinuxUinputDesktop::EventBatch::emit(int type, int code, int value) noexcept {
+	assert(this->count < CAPACITY);
+	auto &ie = this->events[this->count++];
 	ie.type = static_cast<decltype(ie.type)>(type);
 	ie.code = static_cast<decltype(ie.code)>(code);
 	ie.value = static_cast<decltype(ie.value)>(value);
 	ie.time.tv_sec = 0;
 	ie.time.tv_usec = 0;
-	write(fd, &ie, sizeof ie);
 }
 
-void LinuxUinputDesktop::event_syn_report(int fd) noexcept {
-	emit(fd, EV_SYN, SYN_REPORT, 0);
+void LinuxUinputDesktop::EventBatch::syn_report() noexcept {
+	this->emit(EV_SYN, SYN_REPORT, 0);
+}
+
+void LinuxUinputDesktop::EventBatch::submit(Device &dev) noexcept {
+	if (!this->count)
+		return;
+	dev.write(this->events, this->count);
+	this->count = 0;
 }
 
 void LinuxUinputDesktop::keyboard_key(Key k, bool press) noexcept {
@@ -304,18 +804,19 @@ void LinuxUinputDesktop::keyboard_key(Key k, bool press) noexcept {
 		return;
 	}
 
-	const auto fd = this->fd_keyboard;
+	EventBatch batch;
 	const int key_status = press ? 1 : 0;
 	if (key_code & KEY_NEED_SHIFT) {
 		const auto actual_key_code = key_code & ~KEY_NEED_SHIFT;
-		emit(fd, EV_KEY, KEY_LEFTSHIFT, key_status);
-		event_syn_report(fd);
-		emit(fd, EV_KEY, actual_key_code, key_status);
-		event_syn_report(fd);
+		batch.emit(EV_KEY, KEY_LEFTSHIFT, key_status);
+		batch.syn_report();
+		batch.emit(EV_KEY, actual_key_code, key_status);
+		batch.syn_report();
 	} else {
-		emit(fd, EV_KEY, key_code, key_status);
-		event_syn_report(fd);
+		batch.emit(EV_KEY, key_code, key_status);
+		batch.syn_report();
 	}
+	batch.submit(this->keyboard_dev());
 }
 
 void LinuxUinputDesktop::mouse_button(Button b, bool press) noexcept {
@@ -323,25 +824,68 @@ void LinuxUinputDesktop::mouse_button(Button b, bool press) noexcept {
 		return;
 	const int btn_code = btn_code_map[static_cast<std::size_t>(b)];
 
-	const auto fd = this->fd_keyboard;
-	emit(fd, EV_KEY, btn_code, press ? 1 : 0);
-	event_syn_report(fd);
+	EventBatch batch;
+	batch.emit(EV_KEY, btn_code, press ? 1 : 0);
+	batch.syn_report();
+	batch.submit(this->mouse_dev());
 }
 
 void LinuxUinputDesktop::mouse_wheel(Button b) noexcept {
 	const int distance = b == Button::SCROLL_UP ? 1 : -1;
-	const auto fd = this->fd_mouse;
-	emit(fd, EV_REL, REL_WHEEL, distance);
-	event_syn_report(fd);
+	EventBatch batch;
+	batch.emit(EV_REL, REL_WHEEL, distance);
+	batch.emit(EV_REL, REL_WHEEL_HI_RES, distance * SCROLL_NOTCH);
+	batch.syn_report();
+	batch.submit(this->mouse_dev());
+}
+
+void LinuxUinputDesktop::mouse_scroll(int dx, int dy) noexcept {
+	// Devices with high-resolution wheels also report whole notches.
+	this->scroll_rest_x += dx;
+	this->scroll_rest_y += dy;
+	const int notches_x = this->scroll_rest_x / SCROLL_NOTCH;
+	const int notches_y = this->scroll_rest_y / SCROLL_NOTCH;
+	this->scroll_rest_x -= notches_x * SCROLL_NOTCH;
+	this->scroll_rest_y -= notches_y * SCROLL_NOTCH;
+
+	EventBatch batch;
+	if (dy)
+		batch.emit(EV_REL, REL_WHEEL_HI_RES, dy);
+	if (notches_y)
+		batch.emit(EV_REL, REL_WHEEL, notches_y);
+	if (dx)
+		batch.emit(EV_REL, REL_HWHEEL_HI_RES, dx);
+	if (notches_x)
+		batch.emit(EV_REL, REL_HWHEEL, notches_x);
+	batch.syn_report();
+	batch.submit(this->mouse_dev());
 }
 
 void LinuxUinputDesktop::mouse_goto(PointerPosition pos) noexcept {
-	const auto fd = this->fd_mouse;
-	emit(fd, EV_REL, REL_X, INT_MIN);
-	emit(fd, EV_REL, REL_Y, INT_MIN);
-	event_syn_report(fd);
+	auto &dev = this->mouse_dev();
+	EventBatch batch;
+
+	if (this->screen_size.x) {
+		pos.x = std::min(pos.x, this->screen_size.x - 1);
+		pos.y = std::min(pos.y, this->screen_size.y - 1);
+		batch.emit(EV_ABS, ABS_X, static_cast<int>(pos.x));
+		batch.emit(EV_ABS, ABS_Y, static_cast<int>(pos.y));
+		batch.syn_report();
+		batch.submit(dev);
+		this->pointer_position = pos;
+		return;
+	}
+
+	// Without absolute axes, move to the top-left corner first.
+	batch.emit(EV_REL, REL_X, INT_MIN);
+	batch.emit(EV_REL, REL_Y, INT_MIN);
+	batch.syn_report();
+	batch.submit(dev);
+	dev.drain();
 	usleep(1'0000);
-	emit(fd, EV_REL, REL_X, static_cast<int>(pos.x));
-	emit(fd, EV_REL, REL_Y, static_cast<int>(pos.y));
-	event_syn_report(fd);
+	batch.emit(EV_REL, REL_X, static_cast<int>(pos.x));
+	batch.emit(EV_REL, REL_Y, static_cast<int>(pos.y));
+	batch.syn_report();
+	batch.submit(dev);
+	// Relative movements are accelerated, so where the pointer lands is unknown.
 }
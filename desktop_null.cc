@@ -0,0 +1,145 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <ostream>
+
+#include "desktop.h"
+#include "desktops.h"
+#include "desktops_def.h"
+#include "prints.h"
+
+using namespace vinput;
+
+namespace {
+
+// Discards all events. For measuring the cost of the player itself.
+class NullDesktop : public Desktop {
+public:
+	virtual bool ready() const noexcept override;
+	virtual void key(Key k, PressAction a) override;
+	virtual void button(Button b, PressAction a) override;
+	virtual void scroll(int dx, int dy) override;
+	virtual void pointer(PointerPosition pos) override;
+	virtual PointerPosition pointer() const override;
+	virtual void flush() override;
+	virtual void target(std::string_view spec) override;
+	virtual bool simulated_time() const noexcept override;
+	virtual void pass_time(unsigned int time_ms) noexcept override;
+	virtual bool capture(ScreenArea area, std::uint32_t *pixels) override;
+
+protected:
+	PointerPosition pointer_position = { 0, 0 };
+	bool real_time = test_desktop_options.real_time;
+	std::uint64_t simulated_time_ms = 0;
+};
+
+// Tallies events by type and prints the numbers when disconnected.
+class CountDesktop final : public NullDesktop {
+public:
+	~CountDesktop();
+
+	virtual void key(Key k, PressAction a) override;
+	virtual void button(Button b, PressAction a) override;
+	virtual void scroll(int dx, int dy) override;
+	virtual void pointer(PointerPosition pos) override;
+	virtual void flush() override;
+	virtual void target(std::string_view spec) override;
+
+private:
+	std::size_t key_counts[2] = { }; // Release, press.
+	std::size_t button_counts[2] = { }; // Release, press.
+	std::size_t scroll_count = 0;
+	std::size_t pointer_count = 0;
+	std::size_t flush_count = 0;
+	std::size_t target_count = 0;
+};
+
+}
+
+VINPUT_DESKTOP_CONNECTER(null) { return new NullDesktop; }
+
+VINPUT_DESKTOP_CONNECTER(count) { return new CountDesktop; }
+
+bool NullDesktop::ready() const noexcept {
+	return true;
+}
+
+void NullDesktop::key(Key, PressAction) {
+}
+
+void NullDesktop::button(Button, PressAction) {
+}
+
+void NullDesktop::scroll(int, int) {
+}
+
+void NullDesktop::pointer(PointerPosition pos) {
+	this->pointer_position = pos;
+}
+
+NullDesktop::PointerPosition NullDesktop::pointer() const {
+	return this->pointer_position;
+}
+
+void NullDesktop::flush() {
+}
+
+void NullDesktop::target(std::string_view) {
+}
+
+CountDesktop::~CountDesktop() {
+	char buffer[256];
+	const auto n = std::snprintf(
+		buffer, sizeof buffer,
+		"keys: %zu pressed, %zu released\n"
+		"buttons: %zu pressed, %zu released\n"
+		"scrolls: %zu\n"
+		"pointer moves: %zu\n"
+		"targets: %zu\n"
+		"flushes: %zu\n"
+		"simulated time: %.3f s\n",
+		this->key_counts[1], this->key_counts[0],
+		this->button_counts[1], this->button_counts[0],
+		this->scroll_count, this->pointer_count, this->target_count, this->flush_count,
+		double(this->simulated_time_ms) / 1000
+	);
+	if (n > 0)
+		cout().write(buffer, n).flush();
+}
+
+bool NullDesktop::simulated_time() const noexcept {
+	return !this->real_time;
+}
+
+void NullDesktop::pass_time(unsigned int time_ms) noexcept {
+	this->simulated_time_ms += time_ms;
+}
+
+bool NullDesktop::capture(ScreenArea, std::uint32_t *) {
+	return false;
+}
+
+void CountDesktop::key(Key, PressAction a) {
+	this->key_counts[a == PressAction::Press]++;
+}
+
+void CountDesktop::button(Button, PressAction a) {
+	this->button_counts[a == PressAction::Press]++;
+}
+
+void CountDesktop::scroll(int, int) {
+	this->scroll_count++;
+}
+
+void CountDesktop::pointer(PointerPosition pos) {
+	NullDesktop::pointer(pos);
+	this->pointer_count++;
+}
+
+void CountDesktop::flush() {
+	this->flush_count++;
+}
+
+void CountDesktop::target(std::string_view) {
+	this->target_count++;
+}
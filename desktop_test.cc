@@ -1,10 +1,17 @@
+#include <algorithm>
 #include <cassert>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
 #include <cstdio>
-#include <ostream>
+#include <cstring>
+#include <string>
+#include <string_view>
 
 #include "desktop.h"
+#include "desktops.h"
 #include "desktops_def.h"
-#include "prints.h"
+#include "test_record.h"
 
 using namespace vinput;
 
@@ -12,60 +19,99 @@ namespace {
 
 class TestDesktop : public Desktop {
 public:
+	TestDesktop();
+	~TestDesktop();
+
 	virtual bool ready() const noexcept override;
 	virtual void key(Key k, PressAction a) override;
 	virtual void button(Button b, PressAction a) override;
+	virtual void scroll(int dx, int dy) override;
 	virtual void pointer(PointerPosition pos) override;
 	virtual PointerPosition pointer() const override;
 	virtual void flush() override;
+	virtual void target(std::string_view spec) override;
+	virtual bool simulated_time() const noexcept override;
+	virtual void pass_time(unsigned int time_ms) noexcept override;
+	virtual bool capture(ScreenArea area, std::uint32_t *pixels) override;
 
 private:
+	using Clock = std::chrono::steady_clock;
+
+	static constexpr std::size_t BUFFER_SIZE = 1 << 20;
+
 	PointerPosition pointer_position = { 0, 0 };
-	std::ostream *out_stream = &cout();
+	TestDesktopOptions::Format format;
+	std::FILE *file;
+	std::string buffer; // Written out when full, or on flush if to stdout.
+	std::uint64_t sequence = 0;
+	Clock::time_point start_time;
+	bool real_time;
+	std::uint64_t simulated_time_ns = 0;
+
+	void record(
+		TestRecord::Type type, bool press, unsigned int code, int x, int y,
+		std::string_view text = { });
+	void format_text(const TestRecord &rec, std::string_view text);
+	void format_jsonl(const TestRecord &rec, std::string_view text);
+	void format_binary(const TestRecord &rec, std::string_view text);
+	void write_buffer() noexcept;
 };
 
 }
 
+TestDesktopOptions vinput::test_desktop_options;
+
 VINPUT_DESKTOP_CONNECTER(test) { return new TestDesktop; }
 
+TestDesktop::TestDesktop() :
+		format(test_desktop_options.format), real_time(test_desktop_options.real_time) {
+	const auto &path = test_desktop_options.path;
+	if (path.empty() || path == "-") {
+		this->file = stdout;
+	} else {
+		this->file = std::fopen(path.c_str(), "wb");
+		if (!this->file)
+			throw DesktopBaseError("test", "cannot open the output file");
+	}
+	this->buffer.reserve(BUFFER_SIZE + 256);
+	this->start_time = Clock::now();
+
+	if (this->format == TestDesktopOptions::BINARY) {
+		TestRecordHeader header;
+		std::memcpy(header.magic, test_record_magic, sizeof header.magic);
+		header.version = test_record_version;
+		header.record_size = sizeof(TestRecord);
+		this->buffer.append(reinterpret_cast<const char *>(&header), sizeof header);
+	}
+}
+
+TestDesktop::~TestDesktop() {
+	this->write_buffer();
+	if (this->file == stdout)
+		std::fflush(stdout);
+	else
+		std::fclose(this->file);
+}
+
 bool TestDesktop::ready() const noexcept {
 	return true;
 }
 
 void TestDesktop::key(Key k, PressAction a) {
-	char buffer[128];
-	const auto action = a == PressAction::Press ? "press" : "release";
-	const auto name = Desktop::key_to_name(k);
-	const auto n = std::snprintf(
-		buffer, sizeof buffer, "* %-8s %6s <%.*s>\n",
-		action, "key", int(name.size()), name.data()
-	);
-	assert(n > 0);
-	this->out_stream->write(buffer, std::size_t(n));
+	this->record(TestRecord::KEY, a == PressAction::Press, unsigned(k), 0, 0);
 }
 
 void TestDesktop::button(Button b, PressAction a) {
-	char buffer[128];
-	const auto action = a == PressAction::Press ? "press" : "release";
-	const auto name = Desktop::button_to_name(b);
-	const auto n = std::snprintf(
-		buffer, sizeof buffer, "* %-8s %6s <%.*s>\n",
-		action, "button", int(name.size()), name.data()
-	);
-	assert(n > 0);
-	this->out_stream->write(buffer, std::size_t(n));
+	this->record(TestRecord::BUTTON, a == PressAction::Press, unsigned(b), 0, 0);
+}
+
+void TestDesktop::scroll(int dx, int dy) {
+	this->record(TestRecord::SCROLL, false, 0, dx, dy);
 }
 
 void TestDesktop::pointer(PointerPosition pos) {
 	this->pointer_position = pos;
-
-	char buffer[128];
-	const auto n = std::snprintf(
-		buffer, sizeof buffer, "* move pointer to (%u,%u)\n",
-		pos.x, pos.y
-	);
-	assert(n > 0);
-	this->out_stream->write(buffer, std::size_t(n));
+	this->record(TestRecord::POINTER, false, 0, int(pos.x), int(pos.y));
 }
 
 TestDesktop::PointerPosition TestDesktop::pointer() const {
@@ -73,4 +119,200 @@ TestDesktop::PointerPosition TestDesktop::pointer() const {
 }
 
 void TestDesktop::flush() {
+	// Keep the order with other output, like printed pointer positions.
+	if (this->file == stdout) {
+		this->write_buffer();
+		std::fflush(stdout);
+	}
+}
+
+void TestDesktop::target(std::string_view spec) {
+	this->record(TestRecord::TARGET, false, 0, 0, 0, spec.substr(0, 0xffff));
+}
+
+bool TestDesktop::simulated_time() const noexcept {
+	return !this->real_time;
+}
+
+void TestDesktop::pass_time(unsigned int time_ms) noexcept {
+	this->simulated_time_ns += std::uint64_t(time_ms) * 1000000;
+}
+
+bool TestDesktop::capture(ScreenArea, std::uint32_t *) {
+	return false;
+}
+
+void TestDesktop::record(
+		TestRecord::Type type, bool press, unsigned int code, int x, int y,
+		std::string_view text) {
+	TestRecord rec;
+	rec.sequence = this->sequence++;
+	if (this->real_time) {
+		const auto time = Clock::now() - this->start_time;
+		rec.time_ns = std::uint64_t(std::chrono::nanoseconds(time).count());
+	} else {
+		rec.time_ns = this->simulated_time_ns;
+	}
+	rec.type = type;
+	rec.press = press;
+	rec.size = std::uint16_t(text.size());
+	rec.code = code;
+	rec.x = x;
+	rec.y = y;
+
+	switch (this->format) {
+	case TestDesktopOptions::TEXT: this->format_text(rec, text); break;
+	case TestDesktopOptions::JSONL: this->format_jsonl(rec, text); break;
+	case TestDesktopOptions::BINARY: this->format_binary(rec, text); break;
+	}
+	if (this->buffer.size() >= BUFFER_SIZE)
+		this->write_buffer();
+}
+
+void TestDesktop::format_text(const TestRecord &rec, std::string_view text) {
+	format_test_record_text(this->buffer, rec, text);
+}
+
+void vinput::format_test_record_text(
+		std::string &out, const TestRecord &rec, std::string_view text) {
+	using Key = Desktop::Key;
+	using Button = Desktop::Button;
+
+	char buffer[128];
+	int n;
+	const auto action = rec.press ? "press" : "release";
+
+	switch (rec.type) {
+	case TestRecord::KEY: {
+		const auto name = Desktop::key_to_name(static_cast<Key>(rec.code));
+		n = std::snprintf(
+			buffer, sizeof buffer, "* %-8s %6s <%.*s>\n",
+			action, "key", int(name.size()), name.data()
+		);
+		break;
+	}
+
+	case TestRecord::BUTTON: {
+		const auto name = Desktop::button_to_name(static_cast<Button>(rec.code));
+		n = std::snprintf(
+			buffer, sizeof buffer, "* %-8s %6s <%.*s>\n",
+			action, "button", int(name.size()), name.data()
+		);
+		break;
+	}
+
+	case TestRecord::SCROLL:
+		n = std::snprintf(
+			buffer, sizeof buffer, "* scroll wheel by (%+d,%+d)/%d\n",
+			rec.x, rec.y, Desktop::SCROLL_NOTCH
+		);
+		break;
+
+	case TestRecord::POINTER:
+		n = std::snprintf(
+			buffer, sizeof buffer, "* move pointer to (%u,%u)\n",
+			unsigned(rec.x), unsigned(rec.y)
+		);
+		break;
+
+	case TestRecord::TARGET:
+		n = text.empty() ?
+			std::snprintf(buffer, sizeof buffer, "* target focused window\n") :
+			std::snprintf(
+				buffer, sizeof buffer, "* target window <%.*s>\n",
+				int(text.size()), text.data()
+			);
+		break;
+
+	default:
+		n = 0;
+		break;
+	}
+
+	assert(n > 0);
+	out.append(buffer, std::min(std::size_t(n), sizeof buffer - 1));
+}
+
+template <typename T> static void _append_number(std::string &out, T value) {
+	char buffer[24];
+	const auto result = std::to_chars(buffer, buffer + sizeof buffer, value);
+	out.append(buffer, result.ptr);
+}
+
+static void _append_json_string(std::string &out, std::string_view str) {
+	out += '"';
+	for (const char c : str) {
+		if (c == '"' || c == '\\') {
+			out += '\\';
+			out += c;
+		} else if (static_cast<unsigned char>(c) < 0x20) {
+			constexpr char hex_digits[] = "0123456789abcdef";
+			out += "\\u00";
+			out += hex_digits[(c >> 4) & 0xf];
+			out += hex_digits[c & 0xf];
+		} else {
+			out += c;
+		}
+	}
+	out += '"';
+}
+
+void TestDesktop::format_jsonl(const TestRecord &rec, std::string_view text) {
+	auto &out = this->buffer;
+	out += "{\"seq\":";
+	_append_number(out, rec.sequence);
+	out += ",\"time_ns\":";
+	_append_number(out, rec.time_ns);
+
+	switch (rec.type) {
+	case TestRecord::KEY:
+	case TestRecord::BUTTON: {
+		const bool is_key = rec.type == TestRecord::KEY;
+		out += is_key ? ",\"event\":\"key\"" : ",\"event\":\"button\"";
+		out += rec.press ? ",\"action\":\"press\"" : ",\"action\":\"release\"";
+		out += ",\"name\":";
+		_append_json_string(out, is_key ?
+			Desktop::key_to_name(static_cast<Key>(rec.code)) :
+			Desktop::button_to_name(static_cast<Button>(rec.code)));
+		break;
+	}
+
+	case TestRecord::SCROLL:
+		out += ",\"event\":\"scroll\",\"dx\":";
+		_append_number(out, rec.x);
+		out += ",\"dy\":";
+		_append_number(out, rec.y);
+		break;
+
+	case TestRecord::POINTER:
+		out += ",\"event\":\"pointer\",\"x\":";
+		_append_number(out, rec.x);
+		out += ",\"y\":";
+		_append_number(out, rec.y);
+		break;
+
+	case TestRecord::TARGET:
+		out += ",\"event\":\"target\",\"window\":";
+		_append_json_string(out, text);
+		break;
+
+	default:
+		break;
+	}
+	out += "}\n";
+}
+
+void TestDesktop::format_binary(const TestRecord &rec, std::string_view text) {
+	this->buffer.append(reinterpret_cast<const char *>(&rec), sizeof rec);
+	if (text.empty())
+		return;
+	this->buffer.append(text);
+	this->buffer.append((8 - text.size() % 8) % 8, '\0');
+}
+
+void TestDesktop::write_buffer() noexcept {
+	if (this->buffer.empty())
+		return;
+	std::fwrite(this->buffer.data(), 1, this->buffer.size(), this->file);
+	this->buffer.clear();
 }
@@ -0,0 +1,306 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#ifdef _WIN32
+#	include <Windows.h>
+#else
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <unistd.h>
+#endif
+
+#include "desktop.h"
+#include "desktops.h"
+#include "desktops_def.h"
+#include "test_record.h"
+
+using namespace vinput;
+
+namespace {
+
+// Read-only mapping of a whole file.
+class MappedFile {
+public:
+	explicit MappedFile(const char *path);
+	MappedFile(const MappedFile &) = delete;
+	~MappedFile();
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	const char *data() const noexcept { return this->_data; }
+	std::size_t size() const noexcept { return this->_size; }
+
+	// Tell the system that the bytes before `offset` are no longer needed.
+	void release(std::size_t offset) noexcept;
+
+private:
+	const char *_data = nullptr;
+	std::size_t _size = 0;
+#ifdef _WIN32
+	HANDLE mapping = nullptr;
+#else // !_WIN32
+	std::size_t released = 0;
+#endif // _WIN32
+};
+
+// Compares events with an expected trace recorded by the test desktop in
+// binary format, as they arrive. The trace is mapped, not loaded, and pages
+// behind are released, so memory use does not grow with the trace. Times
+// are not compared.
+class VerifyDesktop : public Desktop {
+public:
+	VerifyDesktop();
+
+	virtual bool ready() const noexcept override;
+	virtual void key(Key k, PressAction a) override;
+	virtual void button(Button b, PressAction a) override;
+	virtual void scroll(int dx, int dy) override;
+	virtual void pointer(PointerPosition pos) override;
+	virtual PointerPosition pointer() const override;
+	virtual void flush() override;
+	virtual void target(std::string_view spec) override;
+	virtual bool simulated_time() const noexcept override;
+	virtual bool capture(ScreenArea area, std::uint32_t *pixels) override;
+
+	void finish();
+
+private:
+	// Expected records printed before the divergent one.
+	static constexpr std::size_t CONTEXT_RECORDS = 3;
+	static constexpr std::size_t RELEASE_STEP = 1 << 20;
+
+	MappedFile trace;
+	std::size_t offset; // Of the next expected record.
+	std::size_t context_offsets[CONTEXT_RECORDS] = { }; // Of the records before, as a ring.
+	std::uint64_t sequence = 0;
+	PointerPosition pointer_position = { 0, 0 };
+	bool real_time = test_desktop_options.real_time;
+
+	void check(
+		TestRecord::Type type, bool press, unsigned int code, int x, int y,
+		std::string_view text = { });
+	bool read_record(std::size_t pos, TestRecord &rec, std::string_view &text) const noexcept;
+	[[noreturn]] void diverge(const TestRecord *actual, std::string_view actual_text);
+};
+
+}
+
+VerifyDesktopOptions vinput::verify_desktop_options;
+
+VINPUT_DESKTOP_CONNECTER(verify) { return new VerifyDesktop; }
+
+void vinput::verify_desktop_finish(Desktop &desktop) {
+	if (const auto d = dynamic_cast<VerifyDesktop *>(&desktop))
+		d->finish();
+}
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const char *path) {
+	const auto file = CreateFileA(
+		path, GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		throw DesktopBaseError("verify", "cannot open the expected trace");
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || !size.QuadPart) {
+		CloseHandle(file);
+		throw DesktopBaseError("verify", "empty expected trace");
+	}
+	this->mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(file);
+	if (!this->mapping)
+		throw DesktopBaseError("verify", "cannot map the expected trace");
+	this->_data = static_cast<const char *>(
+		MapViewOfFile(this->mapping, FILE_MAP_READ, 0, 0, 0));
+	if (!this->_data) {
+		CloseHandle(this->mapping);
+		throw DesktopBaseError("verify", "cannot map the expected trace");
+	}
+	this->_size = std::size_t(size.QuadPart);
+}
+
+MappedFile::~MappedFile() {
+	UnmapViewOfFile(this->_data);
+	CloseHandle(this->mapping);
+}
+
+void MappedFile::release(std::size_t) noexcept {
+	// Clean pages of mapped files are trimmed by the system when needed.
+}
+
+#else // !_WIN32
+
+MappedFile::MappedFile(const char *path) {
+	const int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		throw DesktopBaseError("verify", "cannot open the expected trace");
+	struct stat st;
+	if (fstat(fd, &st) || st.st_size <= 0) {
+		close(fd);
+		throw DesktopBaseError("verify", "empty expected trace");
+	}
+	const auto size = std::size_t(st.st_size);
+	const auto data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		throw DesktopBaseError("verify", "cannot map the expected trace");
+	madvise(data, size, MADV_SEQUENTIAL);
+	this->_data = static_cast<const char *>(data);
+	this->_size = size;
+}
+
+MappedFile::~MappedFile() {
+	munmap(const_cast<char *>(this->_data), this->_size);
+}
+
+void MappedFile::release(std::size_t offset) noexcept {
+	const auto page_size = std::size_t(sysconf(_SC_PAGESIZE));
+	offset -= offset % page_size;
+	if (offset <= this->released)
+		return;
+	madvise(
+		const_cast<char *>(this->_data + this->released),
+		offset - this->released, MADV_DONTNEED);
+	this->released = offset;
+}
+
+#endif // _WIN32
+
+VerifyDesktop::VerifyDesktop() : trace(verify_desktop_options.path.c_str()) {
+	TestRecordHeader header;
+	if (this->trace.size() < sizeof header)
+		throw DesktopBaseError("verify", "bad expected trace");
+	std::memcpy(&header, this->trace.data(), sizeof header);
+	if (std::memcmp(header.magic, test_record_magic, sizeof header.magic) ||
+			header.version != test_record_version ||
+			header.record_size != sizeof(TestRecord))
+		throw DesktopBaseError("verify", "bad expected trace");
+	this->offset = sizeof header;
+}
+
+bool VerifyDesktop::ready() const noexcept {
+	return true;
+}
+
+void VerifyDesktop::key(Key k, PressAction a) {
+	this->check(TestRecord::KEY, a == PressAction::Press, unsigned(k), 0, 0);
+}
+
+void VerifyDesktop::button(Button b, PressAction a) {
+	this->check(TestRecord::BUTTON, a == PressAction::Press, unsigned(b), 0, 0);
+}
+
+void VerifyDesktop::scroll(int dx, int dy) {
+	this->check(TestRecord::SCROLL, false, 0, dx, dy);
+}
+
+void VerifyDesktop::pointer(PointerPosition pos) {
+	this->pointer_position = pos;
+	this->check(TestRecord::POINTER, false, 0, int(pos.x), int(pos.y));
+}
+
+VerifyDesktop::PointerPosition VerifyDesktop::pointer() const {
+	return this->pointer_position;
+}
+
+void VerifyDesktop::flush() {
+}
+
+void VerifyDesktop::target(std::string_view spec) {
+	this->check(TestRecord::TARGET, false, 0, 0, 0, spec.substr(0, 0xffff));
+}
+
+bool VerifyDesktop::simulated_time() const noexcept {
+	return !this->real_time;
+}
+
+bool VerifyDesktop::capture(ScreenArea, std::uint32_t *) {
+	return false;
+}
+
+void VerifyDesktop::finish() {
+	if (this->offset < this->trace.size())
+		this->diverge(nullptr, { });
+}
+
+void VerifyDesktop::check(
+		TestRecord::Type type, bool press, unsigned int code, int x, int y,
+		std::string_view text) {
+	TestRecord actual;
+	actual.sequence = this->sequence;
+	actual.time_ns = 0;
+	actual.type = type;
+	actual.press = press;
+	actual.size = std::uint16_t(text.size());
+	actual.code = code;
+	actual.x = x;
+	actual.y = y;
+
+	TestRecord expected;
+	std::string_view expected_text;
+	if (!this->read_record(this->offset, expected, expected_text)) [[unlikely]]
+		this->diverge(&actual, text);
+	if (expected.type != type || expected.press != press || expected.code != code ||
+			expected.x != x || expected.y != y || expected_text != text) [[unlikely]]
+		this->diverge(&actual, text);
+
+	this->context_offsets[this->sequence % CONTEXT_RECORDS] = this->offset;
+	this->offset += sizeof expected + (expected.size + 7) / 8 * 8;
+	this->sequence++;
+	if (this->sequence % (RELEASE_STEP / sizeof expected) == 0)
+		this->trace.release(this->context_offsets[this->sequence % CONTEXT_RECORDS]);
+}
+
+bool VerifyDesktop::read_record(
+		std::size_t pos, TestRecord &rec, std::string_view &text) const noexcept {
+	if (this->trace.size() - pos < sizeof rec)
+		return false;
+	std::memcpy(&rec, this->trace.data() + pos, sizeof rec);
+	pos += sizeof rec;
+	if (this->trace.size() - pos < rec.size)
+		return false;
+	text = {this->trace.data() + pos, rec.size};
+	return true;
+}
+
+void VerifyDesktop::diverge(const TestRecord *actual, std::string_view actual_text) {
+	std::string message;
+	char number[48];
+	std::snprintf(
+		number, sizeof number, "diverged from the trace at event %llu\n",
+		static_cast<unsigned long long>(this->sequence));
+	message += number;
+
+	// The last few matched events, then the expected and the actual one.
+	const auto context_count =
+		this->sequence < CONTEXT_RECORDS ? this->sequence : CONTEXT_RECORDS;
+	for (auto i = this->sequence - context_count; i <= this->sequence; i++) {
+		const auto pos =
+			i < this->sequence ? this->context_offsets[i % CONTEXT_RECORDS] : this->offset;
+		TestRecord rec;
+		std::string_view text;
+		std::snprintf(
+			number, sizeof number, "  %s #%llu ",
+			i < this->sequence ? "    " : "want", static_cast<unsigned long long>(i));
+		message += number;
+		if (this->read_record(pos, rec, text))
+			format_test_record_text(message, rec, text);
+		else
+			message += "(end of trace)\n";
+	}
+	std::snprintf(
+		number, sizeof number, "  got  #%llu ", static_cast<unsigned long long>(this->sequence));
+	message += number;
+	if (actual)
+		format_test_record_text(message, *actual, actual_text);
+	else
+		message += "(end of script)\n";
+	message.pop_back();
+
+	throw TraceDivergedError(message.c_str());
+}
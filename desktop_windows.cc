@@ -17,6 +17,7 @@ public:
 	virtual bool ready() const noexcept override;
 	virtual void key(Key k, PressAction a) override;
 	virtual void button(Button b, PressAction a) override;
+	virtual void scroll(int dx, int dy) override;
 	virtual void pointer(PointerPosition pos) override;
 	virtual PointerPosition pointer() const override;
 	virtual void flush() override;
@@ -35,6 +36,7 @@ private:
 	void send_keyboard_input(Key k, bool down) noexcept;
 	void send_mouse_button_input(Button b, bool down) noexcept;
 	void send_mouse_wheel_input(Button b) noexcept;
+	void send_mouse_wheel_input(int dx, int dy) noexcept;
 	void send_mouse_move_input(PointerPosition pos) noexcept;
 	PointerPosition get_cursor_pos() const noexcept;
 };
@@ -63,6 +65,10 @@ void WindowsDesktop::button(Button b, PressAction a) {
 		this->send_mouse_wheel_input(b);
 }
 
+void WindowsDesktop::scroll(int dx, int dy) {
+	this->send_mouse_wheel_input(dx, dy);
+}
+
 void WindowsDesktop::pointer(PointerPosition pos) {
 	this->send_mouse_move_input(pos);
 }
@@ -289,6 +295,27 @@ void WindowsDesktop::send_mouse_wheel_input(Button b) noexcept {
 	SendInput(1, &input, static_cast<int>(sizeof input));
 }
 
+void WindowsDesktop::send_mouse_wheel_input(int dx, int dy) noexcept {
+	static_assert(SCROLL_NOTCH == WHEEL_DELTA);
+	INPUT inputs[2];
+	UINT count = 0;
+	ZeroMemory(inputs, sizeof inputs);
+	if (dy) {
+		auto &input = inputs[count++];
+		input.type = INPUT_MOUSE;
+		input.mi.dwFlags = MOUSEEVENTF_WHEEL;
+		input.mi.mouseData = static_cast<DWORD>(dy);
+	}
+	if (dx) {
+		auto &input = inputs[count++];
+		input.type = INPUT_MOUSE;
+		input.mi.dwFlags = MOUSEEVENTF_HWHEEL;
+		input.mi.mouseData = static_cast<DWORD>(dx);
+	}
+	if (count)
+		SendInput(count, inputs, static_cast<int>(sizeof inputs[0]));
+}
+
 void WindowsDesktop::send_mouse_move_input(PointerPosition pos) noexcept {
 	INPUT input;
 	ZeroMemory(&input, sizeof input);
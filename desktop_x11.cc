@@ -1,14 +1,37 @@
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <bit>
 #include <cassert>
+#include <cerrno>
 #include <cstdint>
-
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <unistd.h>
+#include <X11/extensions/XInput2.h>
+#include <X11/extensions/XShm.h>
 #include <X11/extensions/XTest.h>
-#include <X11/keysym.h>
 #include <X11/XKBlib.h>
 #include <X11/Xlib.h>
+#include <X11/Xutil.h>
 
 #include "desktop.h"
+#include "desktop_x11_keysyms.h"
+#include "desktops.h"
 #include "desktops_def.h"
+#include "prints.h"
 
 using namespace vinput;
 
@@ -16,77 +39,192 @@ namespace {
 
 class X11Desktop : public Desktop {
 public:
-	X11Desktop();
+	explicit X11Desktop(const char *display_name);
 	~X11Desktop();
 
 	virtual bool ready() const noexcept override;
 	virtual void key(Key k, PressAction a) override;
 	virtual void button(Button b, PressAction a) override;
+	virtual void scroll(int dx, int dy) override;
 	virtual void pointer(PointerPosition pos) override;
 	virtual PointerPosition pointer() const override;
 	virtual void flush() override;
+	virtual void sync() override;
+	virtual void target(std::string_view spec) override;
+	virtual ScreenArea screen_area() const override;
+	virtual bool capture(ScreenArea area, std::uint32_t *pixels) override;
 
 private:
 	class KeyRepInfo {
 	public:
+		static constexpr unsigned int CHARACTER = 1; // Types a Latin-1 character.
+		static constexpr unsigned int CAPS = 2; // Case changed by Caps Lock.
+
 		constexpr KeyRepInfo() noexcept : data(0) { }
-		KeyRepInfo(KeyCode c, unsigned int m) noexcept { assign(c, m); }
+		KeyRepInfo(KeyCode c, unsigned int m, unsigned int f) noexcept { assign(c, m, f); }
 		operator bool() const noexcept { return data; }
-		void assign(KeyCode key_code, unsigned int modifiers) noexcept;
+		void assign(KeyCode key_code, unsigned int modifiers, unsigned int flags) noexcept;
 		KeyCode key_code() const noexcept;
 		unsigned int modifiers_mask() const noexcept;
+		unsigned int flags() const noexcept;
 
 	private:
-		std::uint16_t data;
+		std::uint32_t data;
 	};
 
 	static constexpr auto KEY_COUNT = std::size_t(Key::_COUNT);
 	static constexpr auto BUTTON_COUNT = std::size_t(Button::_COUNT);
-	static const KeySym keysym_map[KEY_COUNT];
 	static const unsigned int button_map[BUTTON_COUNT];
+	static constexpr unsigned int MODIFIER_MASKS[] = {ControlMask, LockMask, ShiftMask};
+
+	static int handle_error(Display *display, XErrorEvent *error) noexcept;
 
 	Display *display;
 	Window root_window;
+	Window focused_window;
+	bool focused_window_valid;
+	Atom net_active_window;
+	Atom net_wm_name = None, utf8_string = None; // Interned when needed.
 	KeyRepInfo keyrep_cache[KEY_COUNT];
-
+	bool xtest_keys;
+	KeyCode modifier_key_codes[std::size(MODIFIER_MASKS)];
+	KeyCode level3_key_code; // ISO_Level3_Shift (AltGr), or 0.
+	unsigned int level3_mask; // Modifier of level3_key_code, or 0.
+	unsigned int held_modifiers = 0; // Modifiers pressed explicitly.
+	KeyCode held_shift_keys[2] = { }; // Left and right Shift pressed explicitly.
+	int xkb_event_base = -1; // Base of XKB events, for the Caps Lock state.
+	bool caps_locked = false;
+	std::uint8_t pressed_modifiers[KEY_COUNT] = { }; // Modifiers pressed for keys.
+	int scroll_rest_x = 0, scroll_rest_y = 0; // Distances less than a notch.
+	Window target_window = None; // Receiver of key events instead of the focus.
+	std::map<std::string, Window, std::less<>> target_cache;
+	Display *pump_display = nullptr; // Connection of the pointer event pump.
+	int pump_xi_opcode;
+	int pump_wake_fd = -1;
+	std::thread pump_thread;
+	std::atomic<std::uint64_t> pointer_cache; // Packed by pack_position().
+	std::atomic<std::uint64_t> pointer_generation = 0; // Of moves sent here.
+	std::mutex pointer_mutex; // For storing to pointer_cache.
+	bool shm_capture; // Capture through MIT-SHM.
+	XImage *shm_image = nullptr; // Kept while captured areas have the same size.
+	XShmSegmentInfo shm_segment;
+
+	static std::uint64_t pack_position(PointerPosition pos) noexcept;
+	static PointerPosition query_pointer(Display *display, Window root_window) noexcept;
+
+	void start_pointer_pump() noexcept;
+	void stop_pointer_pump() noexcept;
+	void pump_pointer_events() noexcept;
+	void load_keymap() noexcept;
+	unsigned int modifier_mask(KeyCode key_code) noexcept;
+	void process_events() noexcept;
+	Window input_focus() noexcept;
+	Window find_window(std::string_view spec) noexcept;
+	bool window_matches(Window window, bool by_class, std::string_view text) noexcept;
 	KeyRepInfo get_keyrep(Key key) noexcept;
 	void send_fake_key_event(Key key, bool press);
+	void send_xtest_key_event(Key key, bool press);
+	void send_xtest_modifiers(unsigned int modifiers, bool press);
+	void send_xtest_held_shift(bool press);
 	void send_fake_button_event(Button button, bool press);
+	void send_fake_scroll_events(int dx, int dy);
 	void send_fake_motion_event(int x, int y);
-	PointerPosition query_pointer() const noexcept;
 	void do_flush() noexcept;
+	XImage *get_shm_image(ScreenArea area) noexcept;
+	void free_shm_image() noexcept;
+	static void convert_image(const XImage *image, std::uint32_t *pixels) noexcept;
 };
 
 }
 
-VINPUT_DESKTOP_CONNECTER(x11) { return new X11Desktop; }
+X11DesktopOptions vinput::x11_desktop_options;
+
+VINPUT_DESKTOP_CONNECTER(x11) { return new X11Desktop(nullptr); }
+
+Desktop *vinput::connect_x11_desktop(const char *display_name) {
+	return new X11Desktop(display_name);
+}
 
 void X11Desktop::KeyRepInfo::assign(
-		KeyCode key_code, unsigned int modifiers) noexcept {
-	static_assert((ShiftMask | LockMask | ControlMask) <= 0b111);
-	this->data = (std::uint16_t(key_code) << 3) | (modifiers & 0b111);
+		KeyCode key_code, unsigned int modifiers, unsigned int flags) noexcept {
+	static_assert(Mod5Mask <= 0xff);
+	this->data = (std::uint32_t(key_code) << 16) | ((flags & 0xff) << 8) | (modifiers & 0xff);
 	assert(this->key_code() == key_code);
 }
 
 KeyCode X11Desktop::KeyRepInfo::key_code() const noexcept {
-	return static_cast<KeyCode>(this->data >> 3);
+	return static_cast<KeyCode>(this->data >> 16);
 }
 
 unsigned int X11Desktop::KeyRepInfo::modifiers_mask() const noexcept {
-	return this->data & 0b111;
+	return this->data & 0xff;
+}
+
+unsigned int X11Desktop::KeyRepInfo::flags() const noexcept {
+	return (this->data >> 8) & 0xff;
 }
 
-X11Desktop::X11Desktop() {
-	this->display = XOpenDisplay(nullptr);
+X11Desktop::X11Desktop(const char *display_name) {
+	// Several connections may be used by different threads.
+	static std::once_flag xlib_init_flag;
+	std::call_once(xlib_init_flag, [] {
+		XInitThreads();
+		XSetErrorHandler(X11Desktop::handle_error);
+	});
+
+	this->display = XOpenDisplay(display_name);
 	if (!this->display)
 		throw DesktopBaseError("x11", "cannot connect to X11 server");
 
-	this->root_window = XRootWindow(this->display, 0);
+	this->root_window = DefaultRootWindow(this->display);
+
+	// Track the focus with events instead of asking the server for every key.
+	// Window managers announce active windows by _NET_ACTIVE_WINDOW on the root.
+	this->focused_window = None;
+	this->focused_window_valid = false;
+	this->net_active_window = XInternAtom(this->display, "_NET_ACTIVE_WINDOW", False);
+	XSelectInput(this->display, this->root_window, PropertyChangeMask);
+
+	this->xtest_keys = x11_desktop_options.xtest_keys;
+	if (this->xtest_keys) {
+		int event_base, error_base, major, minor;
+		if (!XTestQueryExtension(this->display, &event_base, &error_base, &major, &minor)) {
+			XCloseDisplay(this->display);
+			this->display = nullptr;
+			throw DesktopBaseError("x11", "XTest extension is not available");
+		}
+		// Keys typed with XTest are affected by Caps Lock. Follow its state
+		// with XKB events.
+		int xkb_opcode, xkb_error_base;
+		int xkb_major = XkbMajorVersion, xkb_minor = XkbMinorVersion;
+		if (XkbQueryExtension(
+				this->display, &xkb_opcode, &this->xkb_event_base, &xkb_error_base,
+				&xkb_major, &xkb_minor)) {
+			XkbSelectEventDetails(
+				this->display, XkbUseCoreKbd, XkbStateNotify,
+				XkbModifierLockMask, XkbModifierLockMask
+			);
+			if (XkbStateRec state; XkbGetState(this->display, XkbUseCoreKbd, &state) == Success)
+				this->caps_locked = state.locked_mods & LockMask;
+		} else {
+			this->xkb_event_base = -1;
+		}
+	}
+
+	// Shared memory only works with servers on the same machine.
+	const std::string_view display_string(DisplayString(this->display));
+	this->shm_capture = XShmQueryExtension(this->display) &&
+		(display_string.starts_with(':') || display_string.starts_with("unix:"));
+
+	this->load_keymap();
+	this->start_pointer_pump();
 }
 
 X11Desktop::~X11Desktop() {
 	if (!this->display)
 		return;
+	this->stop_pointer_pump();
+	this->free_shm_image();
 	XCloseDisplay(this->display);
 	this->display = nullptr;
 }
@@ -96,143 +234,92 @@ bool X11Desktop::ready() const noexcept {
 }
 
 void X11Desktop::key(Key k, PressAction a) {
-	this->send_fake_key_event(k, a == PressAction::Press);
+	this->process_events();
+	// XTest events always go to the focus.
+	if (this->xtest_keys && this->target_window == None)
+		this->send_xtest_key_event(k, a == PressAction::Press);
+	else
+		this->send_fake_key_event(k, a == PressAction::Press);
 }
 
 void X11Desktop::button(Button b, PressAction a) {
 	this->send_fake_button_event(b, a == PressAction::Press);
 }
 
+void X11Desktop::scroll(int dx, int dy) {
+	this->send_fake_scroll_events(dx, dy);
+}
+
 void X11Desktop::pointer(PointerPosition pos) {
 	this->send_fake_motion_event(int(pos.x), int(pos.y));
 }
 
 X11Desktop::PointerPosition X11Desktop::pointer() const {
-	return this->query_pointer();
+	if (this->pump_display) {
+		const auto packed = this->pointer_cache.load(std::memory_order_relaxed);
+		return {static_cast<unsigned int>(packed >> 32), static_cast<unsigned int>(packed)};
+	}
+	return X11Desktop::query_pointer(this->display, this->root_window);
 }
 
 void X11Desktop::flush() {
 	this->do_flush();
 }
 
-const KeySym X11Desktop::keysym_map[KEY_COUNT] = {
-	XK_0,
-	XK_1,
-	XK_2,
-	XK_3,
-	XK_4,
-	XK_5,
-	XK_6,
-	XK_7,
-	XK_8,
-	XK_9,
-
-	XK_A,
-	XK_B,
-	XK_C,
-	XK_D,
-	XK_E,
-	XK_F,
-	XK_G,
-	XK_H,
-	XK_I,
-	XK_J,
-	XK_K,
-	XK_L,
-	XK_M,
-	XK_N,
-	XK_O,
-	XK_P,
-	XK_Q,
-	XK_R,
-	XK_S,
-	XK_T,
-	XK_U,
-	XK_V,
-	XK_W,
-	XK_X,
-	XK_Y,
-	XK_Z,
-
-	XK_a,
-	XK_b,
-	XK_c,
-	XK_d,
-	XK_e,
-	XK_f,
-	XK_g,
-	XK_h,
-	XK_i,
-	XK_j,
-	XK_k,
-	XK_l,
-	XK_m,
-	XK_n,
-	XK_o,
-	XK_p,
-	XK_q,
-	XK_r,
-	XK_s,
-	XK_t,
-	XK_u,
-	XK_v,
-	XK_w,
-	XK_x,
-	XK_y,
-	XK_z,
-
-	XK_space,
-	XK_exclam,
-	XK_quotedbl,
-	XK_numbersign,
-	XK_dollar,
-	XK_percent,
-	XK_ampersand,
-	XK_apostrophe,
-	XK_parenleft,
-	XK_parenright,
-	XK_asterisk,
-	XK_plus,
-	XK_comma,
-	XK_minus,
-	XK_period,
-	XK_slash,
-	XK_colon,
-	XK_semicolon,
-	XK_less,
-	XK_equal,
-	XK_greater,
-	XK_question,
-	XK_at,
-	XK_bracketleft,
-	XK_backslash,
-	XK_bracketright,
-	XK_asciicircum,
-	XK_underscore,
-	XK_grave,
-	XK_braceleft,
-	XK_bar,
-	XK_braceright,
-	XK_asciitilde,
-
-	XK_BackSpace,
-	XK_Tab,
-	XK_Return,
-	XK_Escape,
-	XK_Delete,
-
-	XK_Control_L,
-	XK_Shift_L,
-	XK_Alt_L,
-	XK_Meta_L,
-	XK_Super_L,
-
-	XK_Control_R,
-	XK_Shift_R,
-	XK_Alt_R,
-	XK_Meta_R,
-	XK_Super_R,
-};
+void X11Desktop::sync() {
+	// The reply comes after all requests before it have been processed.
+	XSync(this->display, False);
+}
+
+void X11Desktop::target(std::string_view spec) {
+	if (spec.empty()) {
+		this->target_window = None;
+		return;
+	}
+	if (const auto iter = this->target_cache.find(spec); iter != this->target_cache.end()) {
+		this->target_window = iter->second;
+		return;
+	}
+	const auto window = this->find_window(spec);
+	if (window == None)
+		throw DesktopBaseError("x11", "cannot find the window");
+	this->target_cache.emplace(spec, window);
+	this->target_window = window;
+}
+
+X11Desktop::ScreenArea X11Desktop::screen_area() const {
+	const auto screen = DefaultScreenOfDisplay(this->display);
+	return {0, 0, unsigned(WidthOfScreen(screen)), unsigned(HeightOfScreen(screen))};
+}
+
+bool X11Desktop::capture(ScreenArea area, std::uint32_t *pixels) {
+	const auto screen = this->screen_area();
+	if (area.x >= screen.width || area.width > screen.width - area.x ||
+			area.y >= screen.height || area.height > screen.height - area.y)
+		throw DesktopBaseError("x11", "area out of the screen");
+
+	if (this->shm_capture) {
+		if (const auto image = this->get_shm_image(area); image &&
+				XShmGetImage(
+					this->display, this->root_window, image,
+					int(area.x), int(area.y), AllPlanes)) {
+			X11Desktop::convert_image(image, pixels);
+			return true;
+		}
+		this->free_shm_image();
+		this->shm_capture = false;
+	}
+
+	// Without shared memory, pixels are copied through the connection.
+	const auto image = XGetImage(
+		this->display, this->root_window,
+		int(area.x), int(area.y), area.width, area.height, AllPlanes, ZPixmap);
+	if (!image)
+		throw DesktopBaseError("x11", "cannot capture the screen");
+	X11Desktop::convert_image(image, pixels);
+	XDestroyImage(image);
+	return true;
+}
 
 const unsigned int X11Desktop::button_map[BUTTON_COUNT] = {
 	Button1,
@@ -242,28 +329,233 @@ const unsigned int X11Desktop::button_map[BUTTON_COUNT] = {
 	Button5,
 };
 
+void X11Desktop::load_keymap() noexcept {
+	constexpr KeySym modifier_key_syms[] = {XK_Control_L, XK_Caps_Lock, XK_Shift_L};
+	static_assert(std::size(modifier_key_syms) == std::size(MODIFIER_MASKS));
+
+	std::fill(std::begin(this->keyrep_cache), std::end(this->keyrep_cache), KeyRepInfo());
+	std::fill(std::begin(this->modifier_key_codes), std::end(this->modifier_key_codes), 0);
+	this->level3_key_code = 0;
+	this->level3_mask = 0;
+
+	// Fetch the whole mapping at once. Prefer unshifted symbols, and then
+	// lower key codes, as XKeysymToKeycode() does. Levels 3 and 4 of the
+	// first group are in columns 4 and 5, and are reached with AltGr.
+	int min_key_code, max_key_code, syms_per_code;
+	XDisplayKeycodes(this->display, &min_key_code, &max_key_code);
+	const auto syms = XGetKeyboardMapping(
+		this->display, KeyCode(min_key_code), max_key_code - min_key_code + 1,
+		&syms_per_code
+	);
+	if (!syms) [[unlikely]]
+		return;
+	for (const int column : {0, 1, 4, 5}) {
+		if (column >= syms_per_code)
+			break;
+		auto modifiers = column & 1 ? ShiftMask : 0u;
+		if (column >= 4) {
+			if (!this->level3_mask)
+				break;
+			modifiers |= this->level3_mask;
+		}
+		for (int key_code = min_key_code; key_code <= max_key_code; key_code++) {
+			const auto sym = syms[(key_code - min_key_code) * syms_per_code + column];
+			if (sym == NoSymbol)
+				continue;
+			const auto sym_iter = std::find(
+				std::begin(x11_keysym_map), std::end(x11_keysym_map), sym);
+			if (sym_iter != std::end(x11_keysym_map)) {
+				auto &rep = this->keyrep_cache[sym_iter - std::begin(x11_keysym_map)];
+				if (!rep) {
+					KeySym lower, upper;
+					XConvertCase(sym, &lower, &upper);
+					unsigned int flags = 0;
+					if (sym >= XK_space && sym <= XK_ydiaeresis)
+						flags |= KeyRepInfo::CHARACTER;
+					if (lower != upper)
+						flags |= KeyRepInfo::CAPS;
+					rep.assign(KeyCode(key_code), modifiers, flags);
+				}
+			}
+			if (column)
+				continue;
+			for (std::size_t i = 0; i < std::size(modifier_key_syms); i++) {
+				if (modifier_key_syms[i] == sym && !this->modifier_key_codes[i])
+					this->modifier_key_codes[i] = KeyCode(key_code);
+			}
+			if (sym == XK_ISO_Level3_Shift && !this->level3_key_code)
+				this->level3_key_code = KeyCode(key_code);
+		}
+		if (!column && this->level3_key_code)
+			this->level3_mask = this->modifier_mask(this->level3_key_code);
+	}
+	XFree(syms);
+}
+
+// The modifier bound to a key, or 0 if none or one of the core ones.
+unsigned int X11Desktop::modifier_mask(KeyCode key_code) noexcept {
+	const auto map = XGetModifierMapping(this->display);
+	if (!map) [[unlikely]]
+		return 0;
+	unsigned int mask = 0;
+	for (int i = 0; i < 8 * map->max_keypermod && !mask; i++) {
+		if (map->modifiermap[i] == key_code)
+			mask = 1u << (i / map->max_keypermod);
+	}
+	XFreeModifiermap(map);
+	return mask & (ShiftMask | LockMask | ControlMask) ? 0 : mask;
+}
+
 X11Desktop::KeyRepInfo X11Desktop::get_keyrep(Key key) noexcept {
 	const auto index = std::size_t(key);
 	if (index >= X11Desktop::KEY_COUNT) [[unlikely]]
 		return { };
-	if (const auto rep = this->keyrep_cache[index]; rep)
-		return rep;
-	const auto key_sym  = keysym_map[index];
-	const auto key_code = XKeysymToKeycode(this->display, key_sym);
-	const auto key_mods =
-		XkbKeycodeToKeysym(this->display, key_code, 0, 0) == key_sym ? 0 : ShiftMask;
-	const KeyRepInfo rep(key_code, key_mods);
-	this->keyrep_cache[index] = rep;
-	return rep;
+	return this->keyrep_cache[index];
+}
+
+int X11Desktop::handle_error(Display *display, XErrorEvent *error) noexcept {
+	// Windows, like the focused one, may be destroyed at any time.
+	if (error->error_code == BadWindow)
+		return 0;
+	char text[80];
+	XGetErrorText(display, error->error_code, text, sizeof text);
+	print_warning("X11 error: %s", text);
+	return 0;
+}
+
+void X11Desktop::process_events() noexcept {
+	// Only read what has arrived. No flushing, no round trip.
+	while (XEventsQueued(this->display, QueuedAfterReading)) {
+		XEvent event;
+		XNextEvent(this->display, &event);
+		switch (event.type) {
+		case PropertyNotify:
+			if (event.xproperty.atom == this->net_active_window)
+				this->focused_window_valid = false;
+			break;
+
+		case FocusIn:
+		case FocusOut:
+			this->focused_window_valid = false;
+			break;
+
+		case MappingNotify:
+			XRefreshKeyboardMapping(&event.xmapping);
+			if (event.xmapping.request != MappingPointer)
+				this->load_keymap();
+			break;
+
+		default:
+			if (event.type == this->xkb_event_base) {
+				const auto &xkb_event = reinterpret_cast<const XkbEvent &>(event);
+				if (xkb_event.any.xkb_type == XkbStateNotify)
+					this->caps_locked = xkb_event.state.locked_mods & LockMask;
+			}
+			break;
+		}
+	}
+}
+
+Window X11Desktop::input_focus() noexcept {
+	if (this->focused_window_valid)
+		return this->focused_window;
+
+	Window window;
+	int revert_to;
+	XGetInputFocus(this->display, &window, &revert_to);
+	if (window != this->focused_window) {
+		if (this->focused_window != None && this->focused_window != PointerRoot)
+			XSelectInput(this->display, this->focused_window, NoEventMask);
+		if (window != None && window != PointerRoot)
+			XSelectInput(this->display, window, FocusChangeMask);
+		this->focused_window = window;
+	}
+	// With PointerRoot, the focus follows the pointer without any event.
+	this->focused_window_valid = window != None && window != PointerRoot;
+	return window;
+}
+
+// Window specifications: an ID (decimal or "0x" hexadecimal), "class:NAME"
+// matching the instance or class name in WM_CLASS, or "title:TEXT" matching
+// windows whose title contains TEXT. Top-level windows are preferred.
+Window X11Desktop::find_window(std::string_view spec) noexcept {
+	if (const std::string id_str(spec); !id_str.empty()) {
+		char *end;
+		const auto id = std::strtoul(id_str.c_str(), &end, 0);
+		if (!*end && id)
+			return Window(id);
+	}
+
+	bool by_class;
+	if (spec.starts_with("class:"))
+		by_class = true;
+	else if (spec.starts_with("title:"))
+		by_class = false;
+	else
+		return None;
+	spec.remove_prefix(6);
+	if (!by_class && this->net_wm_name == None) {
+		this->net_wm_name = XInternAtom(this->display, "_NET_WM_NAME", False);
+		this->utf8_string = XInternAtom(this->display, "UTF8_STRING", False);
+	}
+
+	std::deque<Window> windows{this->root_window};
+	while (!windows.empty()) {
+		const auto window = windows.front();
+		windows.pop_front();
+		if (this->window_matches(window, by_class, spec))
+			return window;
+		Window root, parent, *children;
+		unsigned int children_count;
+		if (!XQueryTree(this->display, window, &root, &parent, &children, &children_count))
+			continue;
+		windows.insert(windows.end(), children, children + children_count);
+		if (children)
+			XFree(children);
+	}
+	return None;
+}
+
+bool X11Desktop::window_matches(
+		Window window, bool by_class, std::string_view text) noexcept {
+	bool matches = false;
+
+	if (by_class) {
+		XClassHint hint;
+		if (!XGetClassHint(this->display, window, &hint))
+			return false;
+		matches = text == hint.res_name || text == hint.res_class;
+		XFree(hint.res_name);
+		XFree(hint.res_class);
+		return matches;
+	}
+
+	Atom type;
+	int format;
+	unsigned long count, remaining;
+	unsigned char *title = nullptr;
+	if (XGetWindowProperty(
+			this->display, window, this->net_wm_name, 0, 1024, False, this->utf8_string,
+			&type, &format, &count, &remaining, &title) == Success && title) {
+		const std::string_view title_str(reinterpret_cast<char *>(title), count);
+		matches = title_str.find(text) != std::string_view::npos;
+		XFree(title);
+		return matches;
+	}
+	if (char *name; XFetchName(this->display, window, &name) && name) {
+		matches = std::string_view(name).find(text) != std::string_view::npos;
+		XFree(name);
+	}
+	return matches;
 }
 
 void X11Desktop::send_fake_key_event(Key key, bool press) {
 	const auto key_rep = this->get_keyrep(key);
-	assert(key_rep);
+	if (!key_rep) [[unlikely]]
+		return; // Not on the keyboard.
 
-	Window focused_window;
-	int focused_revert;
-	XGetInputFocus(display, &focused_window, &focused_revert);
+	const auto focused_window =
+		this->target_window != None ? this->target_window : this->input_focus();
 
 	XKeyEvent key_event;
 	key_event.display = this->display;
@@ -288,6 +580,79 @@ void X11Desktop::send_fake_key_event(Key key, bool press) {
 	);
 }
 
+void X11Desktop::send_xtest_key_event(Key key, bool press) {
+	const auto key_rep = this->get_keyrep(key);
+	if (!key_rep) [[unlikely]]
+		return; // Not on the keyboard.
+
+	unsigned int key_modifier = 0;
+	if (key == Key::SHIFT_L || key == Key::SHIFT_R)
+		key_modifier = ShiftMask;
+	else if (key == Key::CONTROL_L || key == Key::CONTROL_R)
+		key_modifier = ControlMask;
+
+	// Requests are buffered by Xlib, so the modifiers and the key are sent
+	// together on the next flush.
+	auto &pressed_modifiers = this->pressed_modifiers[std::size_t(key)];
+	if (press) {
+		auto required = key_rep.modifiers_mask();
+		// With Caps Lock on, Shift gives the lower case of letters.
+		if (this->caps_locked && (key_rep.flags() & KeyRepInfo::CAPS))
+			required ^= ShiftMask;
+		// A character typed while only Shift is held is meant as written.
+		// Lift the Shift for it, and put it back after.
+		const bool lift_shift = (key_rep.flags() & KeyRepInfo::CHARACTER) &&
+			this->held_modifiers == ShiftMask && !(required & ShiftMask);
+		if (lift_shift)
+			this->send_xtest_held_shift(false);
+		const auto modifiers = required & ~this->held_modifiers;
+		this->send_xtest_modifiers(modifiers, true);
+		pressed_modifiers = std::uint8_t(modifiers);
+		XTestFakeKeyEvent(this->display, key_rep.key_code(), True, CurrentTime);
+		if (lift_shift)
+			this->send_xtest_held_shift(true);
+		this->held_modifiers |= key_modifier;
+		if (key == Key::SHIFT_L || key == Key::SHIFT_R)
+			this->held_shift_keys[key == Key::SHIFT_R] = key_rep.key_code();
+	} else {
+		XTestFakeKeyEvent(this->display, key_rep.key_code(), False, CurrentTime);
+		this->send_xtest_modifiers(pressed_modifiers, false);
+		pressed_modifiers = 0;
+		this->held_modifiers &= ~key_modifier;
+		if (key == Key::SHIFT_L || key == Key::SHIFT_R)
+			this->held_shift_keys[key == Key::SHIFT_R] = 0;
+	}
+}
+
+void X11Desktop::send_xtest_modifiers(unsigned int modifiers, bool press) {
+	// AltGr is pressed last and released first.
+	if (!press && (modifiers & this->level3_mask))
+		XTestFakeKeyEvent(this->display, this->level3_key_code, False, CurrentTime);
+	for (std::size_t i = 0; i < std::size(MODIFIER_MASKS); i++) {
+		// Release in the reverse order of pressing.
+		const auto index = press ? i : std::size(MODIFIER_MASKS) - 1 - i;
+		if (!(modifiers & MODIFIER_MASKS[index]))
+			continue;
+		const auto key_code = this->modifier_key_codes[index];
+		if (MODIFIER_MASKS[index] == LockMask) {
+			// Caps Lock toggles. Tap it to turn on and again to turn off.
+			XTestFakeKeyEvent(this->display, key_code, True, CurrentTime);
+			XTestFakeKeyEvent(this->display, key_code, False, CurrentTime);
+		} else {
+			XTestFakeKeyEvent(this->display, key_code, press, CurrentTime);
+		}
+	}
+	if (press && (modifiers & this->level3_mask))
+		XTestFakeKeyEvent(this->display, this->level3_key_code, True, CurrentTime);
+}
+
+void X11Desktop::send_xtest_held_shift(bool press) {
+	for (const auto key_code : this->held_shift_keys) {
+		if (key_code)
+			XTestFakeKeyEvent(this->display, key_code, press, CurrentTime);
+	}
+}
+
 void X11Desktop::send_fake_button_event(Button button, bool press) {
 	assert(std::size_t(button) < X11Desktop::BUTTON_COUNT);
 	const auto x_button = X11Desktop::button_map[std::size_t(button)];
@@ -295,16 +660,50 @@ void X11Desktop::send_fake_button_event(Button button, bool press) {
 	XTestFakeButtonEvent(this->display, x_button, x_press, CurrentTime);
 }
 
+void X11Desktop::send_fake_scroll_events(int dx, int dy) {
+	// Core protocol has no high-resolution scrolling. Accumulate the distance
+	// and send whole notches as batched clicks of buttons 4-7.
+	this->scroll_rest_x += dx;
+	this->scroll_rest_y += dy;
+	const int notches_x = this->scroll_rest_x / SCROLL_NOTCH;
+	const int notches_y = this->scroll_rest_y / SCROLL_NOTCH;
+	this->scroll_rest_x -= notches_x * SCROLL_NOTCH;
+	this->scroll_rest_y -= notches_y * SCROLL_NOTCH;
+
+	for (const auto [notches, button_pos, button_neg] : {
+			std::array{notches_y, 4, 5}, std::array{notches_x, 7, 6}}) {
+		const auto x_button = static_cast<unsigned int>(notches > 0 ? button_pos : button_neg);
+		for (int i = notches > 0 ? notches : -notches; i > 0; i--) {
+			XTestFakeButtonEvent(this->display, x_button, True, CurrentTime);
+			XTestFakeButtonEvent(this->display, x_button, False, CurrentTime);
+		}
+	}
+}
+
 void X11Desktop::send_fake_motion_event(int x, int y) {
-	XTestFakeMotionEvent(this->display, 0, x, y, CurrentTime);
+	XTestFakeMotionEvent(this->display, DefaultScreen(this->display), x, y, CurrentTime);
+	// Do not wait for the pump to see the motion. Send it first, so that
+	// later queries of the pump are handled after it.
+	if (this->pump_display) {
+		const auto pos = PointerPosition{static_cast<unsigned int>(x), static_cast<unsigned int>(y)};
+		XFlush(this->display);
+		const std::lock_guard lock(this->pointer_mutex);
+		this->pointer_generation.fetch_add(1, std::memory_order_relaxed);
+		this->pointer_cache.store(X11Desktop::pack_position(pos), std::memory_order_relaxed);
+	}
 }
 
-X11Desktop::PointerPosition X11Desktop::query_pointer() const noexcept {
+std::uint64_t X11Desktop::pack_position(PointerPosition pos) noexcept {
+	return std::uint64_t(pos.x) << 32 | std::uint32_t(pos.y);
+}
+
+X11Desktop::PointerPosition X11Desktop::query_pointer(
+		Display *display, Window root_window) noexcept {
 	Window root_win, child_win;
 	int root_x, root_y, win_x, win_y;
 	unsigned int mask;
 	const auto ok = XQueryPointer(
-		this->display, this->root_window,
+		display, root_window,
 		&root_win, &child_win, &root_x, &root_y, &win_x, &win_y, &mask
 	);
 	if (!ok)
@@ -312,6 +711,174 @@ X11Desktop::PointerPosition X11Desktop::query_pointer() const noexcept {
 	return {static_cast<unsigned int>(root_x), static_cast<unsigned int>(root_y)};
 }
 
+// Keep `pointer_cache` updated on a second connection, so that getting the
+// pointer position needs no round trip. The pump waits for XI2 raw motion
+// events, which are reported wherever the pointer is, and queries the
+// position once per batch of them. Without XInput 2, the cache is not used.
+void X11Desktop::start_pointer_pump() noexcept {
+	const auto display = XOpenDisplay(DisplayString(this->display));
+	if (!display)
+		return;
+	int opcode, event_base, error_base, major = 2, minor = 0;
+	if (!XQueryExtension(display, "XInputExtension", &opcode, &event_base, &error_base) ||
+			XIQueryVersion(display, &major, &minor) != Success) {
+		XCloseDisplay(display);
+		return;
+	}
+	const int wake_fd = eventfd(0, EFD_CLOEXEC);
+	if (wake_fd == -1) {
+		XCloseDisplay(display);
+		return;
+	}
+
+	const auto root_window = DefaultRootWindow(display);
+	unsigned char mask_bits[XIMaskLen(XI_RawMotion)] = { };
+	XISetMask(mask_bits, XI_RawMotion);
+	XIEventMask mask = {XIAllMasterDevices, sizeof mask_bits, mask_bits};
+	XISelectEvents(display, root_window, &mask, 1);
+	this->pointer_cache.store(X11Desktop::pack_position(
+		X11Desktop::query_pointer(display, root_window)));
+
+	this->pump_display = display;
+	this->pump_xi_opcode = opcode;
+	this->pump_wake_fd = wake_fd;
+	this->pump_thread = std::thread(&X11Desktop::pump_pointer_events, this);
+}
+
+void X11Desktop::stop_pointer_pump() noexcept {
+	if (!this->pump_display)
+		return;
+	const std::uint64_t one = 1;
+	[[maybe_unused]] const auto n = write(this->pump_wake_fd, &one, sizeof one);
+	this->pump_thread.join();
+	XCloseDisplay(this->pump_display);
+	close(this->pump_wake_fd);
+	this->pump_display = nullptr;
+	this->pump_wake_fd = -1;
+}
+
+void X11Desktop::pump_pointer_events() noexcept {
+	const auto display = this->pump_display;
+	const auto root_window = DefaultRootWindow(display);
+	pollfd fds[2] = {
+		{.fd = ConnectionNumber(display), .events = POLLIN, .revents = 0},
+		{.fd = this->pump_wake_fd, .events = POLLIN, .revents = 0},
+	};
+	while (true) {
+		bool moved = false;
+		while (XPending(display)) {
+			XEvent event;
+			XNextEvent(display, &event);
+			if (event.xcookie.type == GenericEvent &&
+					event.xcookie.extension == this->pump_xi_opcode)
+				moved = true;
+		}
+		if (moved) {
+			// A query started before a move sent by the main connection may
+			// return the old position. Drop it then.
+			const auto generation = this->pointer_generation.load(std::memory_order_relaxed);
+			const auto pos = X11Desktop::query_pointer(display, root_window);
+			const std::lock_guard lock(this->pointer_mutex);
+			if (this->pointer_generation.load(std::memory_order_relaxed) == generation)
+				this->pointer_cache.store(X11Desktop::pack_position(pos), std::memory_order_relaxed);
+		}
+		if (poll(fds, 2, -1) == -1 && errno != EINTR)
+			break;
+		if (fds[1].revents)
+			break;
+	}
+}
+
 void X11Desktop::do_flush() noexcept {
 	XFlush(this->display);
 }
+
+XImage *X11Desktop::get_shm_image(ScreenArea area) noexcept {
+	if (this->shm_image) {
+		if (unsigned(this->shm_image->width) == area.width &&
+				unsigned(this->shm_image->height) == area.height)
+			return this->shm_image;
+		this->free_shm_image();
+	}
+
+	const auto screen = DefaultScreen(this->display);
+	const auto image = XShmCreateImage(
+		this->display, DefaultVisual(this->display, screen),
+		unsigned(DefaultDepth(this->display, screen)), ZPixmap, nullptr,
+		&this->shm_segment, area.width, area.height);
+	if (!image)
+		return nullptr;
+	this->shm_segment.shmid = shmget(
+		IPC_PRIVATE, std::size_t(image->bytes_per_line) * image->height, IPC_CREAT | 0600);
+	if (this->shm_segment.shmid == -1) {
+		XDestroyImage(image);
+		return nullptr;
+	}
+	this->shm_segment.shmaddr = image->data =
+		static_cast<char *>(shmat(this->shm_segment.shmid, nullptr, 0));
+	this->shm_segment.readOnly = False;
+	if (this->shm_segment.shmaddr == reinterpret_cast<char *>(-1) ||
+			!XShmAttach(this->display, &this->shm_segment)) {
+		if (this->shm_segment.shmaddr != reinterpret_cast<char *>(-1))
+			shmdt(this->shm_segment.shmaddr);
+		shmctl(this->shm_segment.shmid, IPC_RMID, nullptr);
+		image->data = nullptr;
+		XDestroyImage(image);
+		return nullptr;
+	}
+	// Once the server has attached it, the segment can be marked for removal,
+	// so that it is freed even if the program is killed.
+	XSync(this->display, False);
+	shmctl(this->shm_segment.shmid, IPC_RMID, nullptr);
+	this->shm_image = image;
+	return image;
+}
+
+void X11Desktop::free_shm_image() noexcept {
+	if (!this->shm_image)
+		return;
+	XShmDetach(this->display, &this->shm_segment);
+	XSync(this->display, False);
+	this->shm_image->data = nullptr;
+	XDestroyImage(this->shm_image);
+	shmdt(this->shm_segment.shmaddr);
+	this->shm_image = nullptr;
+}
+
+void X11Desktop::convert_image(const XImage *image, std::uint32_t *pixels) noexcept {
+	const auto width = std::size_t(image->width), height = std::size_t(image->height);
+	constexpr int native_byte_order =
+		std::endian::native == std::endian::little ? LSBFirst : MSBFirst;
+
+	// Usual 24-bit depth in 32-bit pixels, already 0x??RRGGBB.
+	if (image->bits_per_pixel == 32 && image->byte_order == native_byte_order &&
+			image->red_mask == 0xff0000 && image->green_mask == 0xff00 &&
+			image->blue_mask == 0xff) {
+		for (std::size_t y = 0; y < height; y++) {
+			const auto row = image->data + y * std::size_t(image->bytes_per_line);
+			std::memcpy(pixels + y * width, row, width * sizeof *pixels);
+			for (std::size_t x = 0; x < width; x++)
+				pixels[y * width + x] &= 0xffffff;
+		}
+		return;
+	}
+
+	// Other visuals: scale each channel to 8 bits.
+	const auto channel = [](unsigned long pixel, unsigned long mask) -> std::uint32_t {
+		if (!mask)
+			return 0;
+		const auto value = (pixel & mask) >> std::countr_zero(mask);
+		const auto max = mask >> std::countr_zero(mask);
+		return std::uint32_t(value * 255 / max);
+	};
+	auto xi = const_cast<XImage *>(image);
+	for (std::size_t y = 0; y < height; y++) {
+		for (std::size_t x = 0; x < width; x++) {
+			const auto pixel = XGetPixel(xi, int(x), int(y));
+			*pixels++ =
+				channel(pixel, image->red_mask) << 16 |
+				channel(pixel, image->green_mask) << 8 |
+				channel(pixel, image->blue_mask);
+		}
+	}
+}
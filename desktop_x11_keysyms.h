@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+
+#include <X11/keysym.h>
+
+#include "desktop.h"
+
+namespace vinput {
+
+// Key symbols of `Desktop::Key`s, for X11 based desktops.
+inline constexpr std::uint32_t x11_keysym_map[] = {
+	XK_0,
+	XK_1,
+	XK_2,
+	XK_3,
+	XK_4,
+	XK_5,
+	XK_6,
+	XK_7,
+	XK_8,
+	XK_9,
+
+	XK_A,
+	XK_B,
+	XK_C,
+	XK_D,
+	XK_E,
+	XK_F,
+	XK_G,
+	XK_H,
+	XK_I,
+	XK_J,
+	XK_K,
+	XK_L,
+	XK_M,
+	XK_N,
+	XK_O,
+	XK_P,
+	XK_Q,
+	XK_R,
+	XK_S,
+	XK_T,
+	XK_U,
+	XK_V,
+	XK_W,
+	XK_X,
+	XK_Y,
+	XK_Z,
+
+	XK_a,
+	XK_b,
+	XK_c,
+	XK_d,
+	XK_e,
+	XK_f,
+	XK_g,
+	XK_h,
+	XK_i,
+	XK_j,
+	XK_k,
+	XK_l,
+	XK_m,
+	XK_n,
+	XK_o,
+	XK_p,
+	XK_q,
+	XK_r,
+	XK_s,
+	XK_t,
+	XK_u,
+	XK_v,
+	XK_w,
+	XK_x,
+	XK_y,
+	XK_z,
+
+	XK_space,
+	XK_exclam,
+	XK_quotedbl,
+	XK_numbersign,
+	XK_dollar,
+	XK_percent,
+	XK_ampersand,
+	XK_apostrophe,
+	XK_parenleft,
+	XK_parenright,
+	XK_asterisk,
+	XK_plus,
+	XK_comma,
+	XK_minus,
+	XK_period,
+	XK_slash,
+	XK_colon,
+	XK_semicolon,
+	XK_less,
+	XK_equal,
+	XK_greater,
+	XK_question,
+	XK_at,
+	XK_bracketleft,
+	XK_backslash,
+	XK_bracketright,
+	XK_asciicircum,
+	XK_underscore,
+	XK_grave,
+	XK_braceleft,
+	XK_bar,
+	XK_braceright,
+	XK_asciitilde,
+
+	XK_BackSpace,
+	XK_Tab,
+	XK_Return,
+	XK_Escape,
+	XK_Delete,
+
+	XK_Control_L,
+	XK_Shift_L,
+	XK_Alt_L,
+	XK_Meta_L,
+	XK_Super_L,
+
+	XK_Control_R,
+	XK_Shift_R,
+	XK_Alt_R,
+	XK_Meta_R,
+	XK_Super_R,
+};
+
+static_assert(std::size(x11_keysym_map) == std::size_t(Desktop::Key::_COUNT));
+
+}
@@ -0,0 +1,262 @@
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <iterator>
+
+#include <xcb/xcb.h>
+#include <xcb/xtest.h>
+
+#include "desktop.h"
+#include "desktop_x11_keysyms.h"
+#include "desktops.h"
+#include "desktops_def.h"
+
+using namespace vinput;
+
+namespace {
+
+// Requests are only queued and sent on flush. No reply is waited for unless
+// the script asks for a state, like the pointer position.
+class XcbDesktop : public Desktop {
+public:
+	explicit XcbDesktop(const char *display_name);
+	~XcbDesktop();
+
+	virtual bool ready() const noexcept override;
+	virtual void key(Key k, PressAction a) override;
+	virtual void button(Button b, PressAction a) override;
+	virtual void scroll(int dx, int dy) override;
+	virtual void pointer(PointerPosition pos) override;
+	virtual PointerPosition pointer() const override;
+	virtual void flush() override;
+	virtual void sync() override;
+
+private:
+	struct KeyRep {
+		xcb_keycode_t key_code = 0; // 0 if not on the keyboard.
+		bool shift = false;
+	};
+
+	static constexpr auto KEY_COUNT = std::size_t(Key::_COUNT);
+	static constexpr auto BUTTON_COUNT = std::size_t(Button::_COUNT);
+	static constexpr std::uint8_t button_map[BUTTON_COUNT] = {1, 2, 3, 4, 5};
+
+	xcb_connection_t *connection;
+	xcb_window_t root_window;
+	xcb_keycode_t min_key_code, max_key_code;
+	xcb_get_keyboard_mapping_cookie_t keymap_cookie;
+	bool keymap_pending = false;
+	KeyRep keymap[KEY_COUNT];
+	xcb_keycode_t shift_key_code = 0;
+	bool shift_held = false; // Shift pressed explicitly.
+	bool shift_pressed[KEY_COUNT] = { }; // Shift pressed for keys.
+	int scroll_rest_x = 0, scroll_rest_y = 0; // Distances less than a notch.
+
+	void request_keymap() noexcept;
+	void receive_keymap() noexcept;
+	void process_events() noexcept;
+	void fake_input(
+		std::uint8_t type, std::uint8_t detail,
+		std::int16_t x = 0, std::int16_t y = 0) noexcept;
+};
+
+}
+
+VINPUT_DESKTOP_CONNECTER(xcb) { return new XcbDesktop(nullptr); }
+
+Desktop *vinput::connect_xcb_desktop(const char *display_name) {
+	return new XcbDesktop(display_name);
+}
+
+XcbDesktop::XcbDesktop(const char *display_name) {
+	int screen_number;
+	this->connection = xcb_connect(display_name, &screen_number);
+	if (xcb_connection_has_error(this->connection)) {
+		xcb_disconnect(this->connection);
+		this->connection = nullptr;
+		throw DesktopUnavailabeError("xcb");
+	}
+
+	const auto setup = xcb_get_setup(this->connection);
+	auto screen_iter = xcb_setup_roots_iterator(setup);
+	for (; screen_number > 0 && screen_iter.rem > 1; screen_number--)
+		xcb_screen_next(&screen_iter);
+	this->root_window = screen_iter.data->root;
+	this->min_key_code = setup->min_keycode;
+	this->max_key_code = setup->max_keycode;
+
+	const auto xtest = xcb_get_extension_data(this->connection, &xcb_test_id);
+	if (!xtest || !xtest->present) {
+		xcb_disconnect(this->connection);
+		this->connection = nullptr;
+		throw DesktopBaseError("xcb", "XTest extension is not available");
+	}
+
+	// The reply is collected when the first key is sent.
+	this->request_keymap();
+}
+
+XcbDesktop::~XcbDesktop() {
+	if (!this->connection)
+		return;
+	if (this->keymap_pending)
+		xcb_discard_reply(this->connection, this->keymap_cookie.sequence);
+	xcb_flush(this->connection);
+	xcb_disconnect(this->connection);
+	this->connection = nullptr;
+}
+
+bool XcbDesktop::ready() const noexcept {
+	return this->connection && !xcb_connection_has_error(this->connection);
+}
+
+void XcbDesktop::key(Key k, PressAction a) {
+	this->process_events();
+	this->receive_keymap();
+
+	const auto index = std::size_t(k);
+	if (index >= XcbDesktop::KEY_COUNT) [[unlikely]]
+		return;
+	const auto key_rep = this->keymap[index];
+	if (!key_rep.key_code) [[unlikely]]
+		return; // Not on the keyboard.
+	const bool is_shift = k == Key::SHIFT_L || k == Key::SHIFT_R;
+
+	if (a == PressAction::Press) {
+		const bool shift = key_rep.shift && !this->shift_held && this->shift_key_code;
+		if (shift)
+			this->fake_input(XCB_KEY_PRESS, this->shift_key_code);
+		this->shift_pressed[index] = shift;
+		this->fake_input(XCB_KEY_PRESS, key_rep.key_code);
+		if (is_shift)
+			this->shift_held = true;
+	} else {
+		this->fake_input(XCB_KEY_RELEASE, key_rep.key_code);
+		if (this->shift_pressed[index])
+			this->fake_input(XCB_KEY_RELEASE, this->shift_key_code);
+		this->shift_pressed[index] = false;
+		if (is_shift)
+			this->shift_held = false;
+	}
+}
+
+void XcbDesktop::button(Button b, PressAction a) {
+	const auto index = std::size_t(b);
+	if (index >= XcbDesktop::BUTTON_COUNT) [[unlikely]]
+		return;
+	const auto type = a == PressAction::Press ? XCB_BUTTON_PRESS : XCB_BUTTON_RELEASE;
+	this->fake_input(type, XcbDesktop::button_map[index]);
+}
+
+void XcbDesktop::scroll(int dx, int dy) {
+	// Core protocol has no high-resolution scrolling. Accumulate the distance
+	// and send whole notches as clicks of buttons 4-7.
+	this->scroll_rest_x += dx;
+	this->scroll_rest_y += dy;
+	const int notches_x = this->scroll_rest_x / SCROLL_NOTCH;
+	const int notches_y = this->scroll_rest_y / SCROLL_NOTCH;
+	this->scroll_rest_x -= notches_x * SCROLL_NOTCH;
+	this->scroll_rest_y -= notches_y * SCROLL_NOTCH;
+
+	for (const auto [notches, button_pos, button_neg] : {
+			std::array{notches_y, 4, 5}, std::array{notches_x, 7, 6}}) {
+		const auto button = std::uint8_t(notches > 0 ? button_pos : button_neg);
+		for (int i = notches > 0 ? notches : -notches; i > 0; i--) {
+			this->fake_input(XCB_BUTTON_PRESS, button);
+			this->fake_input(XCB_BUTTON_RELEASE, button);
+		}
+	}
+}
+
+void XcbDesktop::pointer(PointerPosition pos) {
+	// Detail 0 means absolute coordinates.
+	this->fake_input(XCB_MOTION_NOTIFY, 0, std::int16_t(pos.x), std::int16_t(pos.y));
+}
+
+XcbDesktop::PointerPosition XcbDesktop::pointer() const {
+	const auto cookie = xcb_query_pointer(this->connection, this->root_window);
+	const auto reply = xcb_query_pointer_reply(this->connection, cookie, nullptr);
+	if (!reply)
+		return {0, 0};
+	const PointerPosition pos = {
+		static_cast<unsigned int>(reply->root_x),
+		static_cast<unsigned int>(reply->root_y),
+	};
+	std::free(reply);
+	return pos;
+}
+
+void XcbDesktop::flush() {
+	xcb_flush(this->connection);
+}
+
+void XcbDesktop::sync() {
+	// Any request with a reply does; this one is the cheapest.
+	std::free(xcb_get_input_focus_reply(
+		this->connection, xcb_get_input_focus(this->connection), nullptr));
+}
+
+void XcbDesktop::request_keymap() noexcept {
+	if (this->keymap_pending)
+		xcb_discard_reply(this->connection, this->keymap_cookie.sequence);
+	this->keymap_cookie = xcb_get_keyboard_mapping(
+		this->connection, this->min_key_code,
+		std::uint8_t(this->max_key_code - this->min_key_code + 1)
+	);
+	this->keymap_pending = true;
+}
+
+void XcbDesktop::receive_keymap() noexcept {
+	if (!this->keymap_pending)
+		return;
+	this->keymap_pending = false;
+	const auto reply = xcb_get_keyboard_mapping_reply(
+		this->connection, this->keymap_cookie, nullptr);
+	std::fill(std::begin(this->keymap), std::end(this->keymap), KeyRep());
+	this->shift_key_code = 0;
+	if (!reply) [[unlikely]]
+		return;
+
+	// Prefer unshifted symbols, and then lower key codes.
+	const int syms_per_code = reply->keysyms_per_keycode;
+	const auto syms = xcb_get_keyboard_mapping_keysyms(reply);
+	const int code_count = this->max_key_code - this->min_key_code + 1;
+	for (int column = 0; column < std::min(syms_per_code, 2); column++) {
+		for (int i = 0; i < code_count; i++) {
+			const auto sym = syms[i * syms_per_code + column];
+			if (sym == XK_VoidSymbol || sym == 0)
+				continue;
+			const auto key_code = xcb_keycode_t(this->min_key_code + i);
+			const auto sym_iter = std::find(
+				std::begin(x11_keysym_map), std::end(x11_keysym_map), sym);
+			if (sym_iter != std::end(x11_keysym_map)) {
+				auto &rep = this->keymap[sym_iter - std::begin(x11_keysym_map)];
+				if (!rep.key_code)
+					rep = {key_code, column != 0};
+			}
+			if (!column && sym == XK_Shift_L && !this->shift_key_code)
+				this->shift_key_code = key_code;
+		}
+	}
+	std::free(reply);
+}
+
+void XcbDesktop::process_events() noexcept {
+	// Errors of unchecked requests arrive as events too; they are dropped.
+	while (const auto event = xcb_poll_for_event(this->connection)) {
+		if ((event->response_type & 0x7f) == XCB_MAPPING_NOTIFY) {
+			const auto mapping = reinterpret_cast<xcb_mapping_notify_event_t *>(event);
+			if (mapping->request != XCB_MAPPING_POINTER)
+				this->request_keymap();
+		}
+		std::free(event);
+	}
+}
+
+void XcbDesktop::fake_input(
+		std::uint8_t type, std::uint8_t detail, std::int16_t x, std::int16_t y) noexcept {
+	const auto root = type == XCB_MOTION_NOTIFY ? this->root_window : XCB_NONE;
+	xcb_test_fake_input(
+		this->connection, type, detail, XCB_CURRENT_TIME, root, x, y, XCB_NONE);
+}
@@ -14,14 +14,22 @@ using namespace vinput;
 #if VINPUT_DESKTOP_X11
 	VINPUT_DESKTOP_CONNECTER(x11);
 #endif // VINPUT_DESKTOP_X11
+#if VINPUT_DESKTOP_XCB
+	VINPUT_DESKTOP_CONNECTER(xcb);
+#endif // VINPUT_DESKTOP_XCB
 
 VINPUT_DESKTOP_CONNECTER(test);
+VINPUT_DESKTOP_CONNECTER(null);
+VINPUT_DESKTOP_CONNECTER(count);
+VINPUT_DESKTOP_CONNECTER(verify);
 
 static Desktop *(*const available_desktops[])() = {
 #if VINPUT_DESKTOP_WINDOWS
 	VINPUT_DESKTOP_CONNECTER_NAME(windows),
 #endif // VINPUT_DESKTOP_WINDOWS
 
+	// Not xcb, which lacks windows targeting and screen capture; it is only
+	// used if asked for by name.
 #if VINPUT_DESKTOP_X11
 	VINPUT_DESKTOP_CONNECTER_NAME(x11),
 #endif // VINPUT_DESKTOP_X11
@@ -30,6 +38,28 @@ static Desktop *(*const available_desktops[])() = {
 #endif // VINPUT_DESKTOP_LINUX
 };
 
+static const struct {
+	std::string_view name;
+	Desktop *(*func)();
+} named_desktops[] = {
+#if VINPUT_DESKTOP_WINDOWS
+	{"windows", VINPUT_DESKTOP_CONNECTER_NAME(windows)},
+#endif // VINPUT_DESKTOP_WINDOWS
+#if VINPUT_DESKTOP_X11
+	{"x11", VINPUT_DESKTOP_CONNECTER_NAME(x11)},
+#endif // VINPUT_DESKTOP_X11
+#if VINPUT_DESKTOP_XCB
+	{"xcb", VINPUT_DESKTOP_CONNECTER_NAME(xcb)},
+#endif // VINPUT_DESKTOP_XCB
+#if VINPUT_DESKTOP_LINUX
+	{"linux", VINPUT_DESKTOP_CONNECTER_NAME(linux)},
+#endif // VINPUT_DESKTOP_LINUX
+	{"test", VINPUT_DESKTOP_CONNECTER_NAME(test)},
+	{"null", VINPUT_DESKTOP_CONNECTER_NAME(null)},
+	{"count", VINPUT_DESKTOP_CONNECTER_NAME(count)},
+	{"verify", VINPUT_DESKTOP_CONNECTER_NAME(verify)},
+};
+
 [[nodiscard]] Desktop *vinput::connect_current_desktop() {
 	Desktop *desktop;
 	for (auto func : available_desktops) {
@@ -48,6 +78,24 @@ static Desktop *(*const available_desktops[])() = {
 	return desktop;
 }
 
+[[nodiscard]] Desktop *vinput::connect_named_desktop(std::string_view name) {
+	for (const auto &[desktop_name, func] : named_desktops) {
+		if (desktop_name == name)
+			return func();
+	}
+	throw DesktopBaseError("vinput", "unknown desktop");
+}
+
+std::string vinput::desktop_names() {
+	std::string names;
+	for (const auto &[desktop_name, func] : named_desktops) {
+		if (!names.empty())
+			names += ", ";
+		names += desktop_name;
+	}
+	return names;
+}
+
 void vinput::disconnect_desktop(Desktop *desktop) noexcept {
 	delete desktop;
 }
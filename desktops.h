@@ -1,5 +1,9 @@
 #pragma once
 
+#include <cstddef>
+#include <string>
+#include <string_view>
+
 namespace vinput {
 
 class Desktop;
@@ -7,9 +11,127 @@ class Desktop;
 // Try to connect the desktop which is in use.
 [[nodiscard]] Desktop *connect_current_desktop();
 
+// Options of the testing desktop. Change them before connecting.
+struct TestDesktopOptions {
+	enum Format {
+		TEXT,   // Human readable lines.
+		JSONL,  // One JSON object per line.
+		BINARY, // See "test_record.h".
+	};
+
+	Format format = TEXT;
+	// Output file. Standard output if empty or "-".
+	std::string path;
+	// Sleep for real instead of advancing a simulated clock. Also used by the
+	// null and count desktops.
+	bool real_time = false;
+};
+
+extern TestDesktopOptions test_desktop_options;
+
 // Connect the testing desktop.
 [[nodiscard]] Desktop *connect_test_desktop();
 
+// Options of the verifying desktop, which compares events with an expected
+// trace instead of sending them. Change them before connecting.
+struct VerifyDesktopOptions {
+	// Expected trace, written by the testing desktop in binary format.
+	std::string path;
+};
+
+extern VerifyDesktopOptions verify_desktop_options;
+
+// Check that the verifying desktop has received all events of the expected
+// trace, or throw TraceDivergedError. Does nothing for other desktops.
+void verify_desktop_finish(Desktop &desktop);
+
+// Connect a desktop by its name, like "x11", "test" or "null" (discards
+// events) or "count" (prints the number of events when disconnected).
+[[nodiscard]] Desktop *connect_named_desktop(std::string_view name);
+
+// Names of the desktops that connect_named_desktop() accepts, comma separated.
+std::string desktop_names();
+
+#if VINPUT_DESKTOP_LINUX
+
+// Options of the uinput desktop. Change them before connecting.
+struct LinuxDesktopOptions {
+	// Screen size. If given, an absolute pointer device is created so that
+	// the pointer can be moved precisely; otherwise relative movements are used,
+	// and the pointer position is not known.
+	unsigned int screen_width = 0, screen_height = 0;
+	// Create one device for keys, buttons, motion and wheel, instead of
+	// separate keyboard and mouse devices.
+	bool composite = false;
+	// Submit events through io_uring if the kernel supports it.
+	bool io_uring = false;
+	// Sleep for LINUX_DESKTOP_SETTLE_MS after creating the devices and before
+	// destroying them, for the system to set them up and handle the last
+	// events. Without it, the caller has to wait.
+	bool settle = true;
+};
+
+constexpr unsigned int LINUX_DESKTOP_SETTLE_MS = 500;
+
+extern LinuxDesktopOptions linux_desktop_options;
+
+// Counters of events sent to uinput devices.
+struct LinuxDesktopStats {
+	std::size_t written; // Events written.
+	std::size_t retried; // Events queued and retried because the device was busy.
+	std::size_t dropped; // Events given up.
+};
+
+// Get counters of the uinput desktop. All zero for other kinds of desktops.
+LinuxDesktopStats linux_desktop_stats(const Desktop &desktop) noexcept;
+
+// An io_uring shared by uinput desktops used on one thread, so that their
+// events are written together by few syscalls.
+struct LinuxDesktopRing;
+
+// Create a ring with room for `entries` writes at once, or return null if
+// io_uring is not supported. Destroy it after the desktops on it.
+[[nodiscard]] LinuxDesktopRing *create_linux_desktop_ring(unsigned int entries);
+void destroy_linux_desktop_ring(LinuxDesktopRing *ring) noexcept;
+
+// Write the events queued by all desktops on the ring, and wait for them.
+void linux_desktop_ring_submit(LinuxDesktopRing &ring) noexcept;
+
+// Create the uinput desktop on opened file descriptors, which are usually
+// of "/dev/uinput" but can be mocks. The descriptors will be closed with it.
+// Argument `fd_mouse` is not used (should be -1) in composite mode. With a
+// ring, flush() only queues events, until linux_desktop_ring_submit().
+[[nodiscard]] Desktop *connect_linux_desktop(
+	int fd_keyboard, int fd_mouse, LinuxDesktopRing *ring = nullptr);
+
+#endif // VINPUT_DESKTOP_LINUX
+
+#if VINPUT_DESKTOP_X11
+
+// Options of the X11 desktop. Change them before connecting.
+struct X11DesktopOptions {
+	// Inject keys with XTest as if typed on the keyboard, instead of sending
+	// events to the focused window. Required modifiers, AltGr included, are
+	// pressed around keys, with Caps Lock taken into account. A Shift held
+	// alone is lifted for characters that do not need it.
+	bool xtest_keys = false;
+};
+
+extern X11DesktopOptions x11_desktop_options;
+
+// Connect the X11 desktop on the given display, or the default one if null.
+// Desktops on different displays can be used from different threads.
+[[nodiscard]] Desktop *connect_x11_desktop(const char *display_name);
+
+#endif // VINPUT_DESKTOP_X11
+
+#if VINPUT_DESKTOP_XCB
+
+// Connect the XCB desktop on the given display, or the default one if null.
+[[nodiscard]] Desktop *connect_xcb_desktop(const char *display_name);
+
+#endif // VINPUT_DESKTOP_XCB
+
 // Close the connection.
 void disconnect_desktop(Desktop *desktop) noexcept;
 
@@ -0,0 +1,488 @@
+#include "image_search.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <istream>
+#include <limits>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+#	define VINPUT_IMAGE_SEARCH_SSE2 1
+#	include <emmintrin.h>
+#	if defined(__GNUC__)
+#		define VINPUT_IMAGE_SEARCH_AVX2 1
+#		include <immintrin.h>
+#	endif
+#endif
+
+using namespace vinput;
+
+// Bytes after the pixels of a level, so that vectors can be loaded from
+// anywhere in it. Bytes beyond rows are masked out.
+static constexpr std::size_t level_padding = 64;
+
+// Limit of pixels in an image file.
+static constexpr std::size_t ppm_pixels_limit = std::size_t(1) << 24;
+
+// Positions searched at once by block_sads functions.
+static constexpr unsigned int block_positions = 32;
+
+using row_sad_func_t = std::uint32_t (*)(
+	const std::uint8_t *, const std::uint8_t *, std::size_t) noexcept;
+using block_sads_func_t = void (*)(
+	const std::uint8_t *, std::size_t, const std::uint8_t *, unsigned int, unsigned int,
+	std::uint16_t *) noexcept;
+
+// Row SAD functions: sum of absolute differences of `n` bytes. Vectors may
+// be loaded from up to 15 bytes after them; bytes beyond are masked out.
+// Block SADs functions: sums of absolute differences of the template (`tw`
+// x `th` bytes) and the image from `image` (rows of `stride` bytes) at each
+// of the next `block_positions` positions. The template must have no more
+// than 257 pixels, so that sums fit in 16 bits.
+
+static std::uint32_t _row_sad_scalar(
+		const std::uint8_t *a, const std::uint8_t *b, std::size_t n) noexcept {
+	std::uint32_t sum = 0;
+	for (std::size_t i = 0; i < n; i++)
+		sum += std::uint32_t(std::abs(int(a[i]) - int(b[i])));
+	return sum;
+}
+
+#if VINPUT_IMAGE_SEARCH_SSE2
+
+// 16 bytes of 0xff and then 16 of 0; 16 bytes from `16 - n` keep the first n.
+alignas(16) static constexpr std::uint8_t _tail_masks[32] = {
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+};
+
+static inline __m128i _row_sad_sse2_tail(
+		const std::uint8_t *a, const std::uint8_t *b, std::size_t n) noexcept {
+	__m128i sum = _mm_setzero_si128();
+	std::size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		const auto va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+		const auto vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+		sum = _mm_add_epi64(sum, _mm_sad_epu8(va, vb));
+	}
+	if (i < n) {
+		const auto mask =
+			_mm_loadu_si128(reinterpret_cast<const __m128i *>(_tail_masks + 16 - (n - i)));
+		const auto va = _mm_and_si128(
+			_mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i)), mask);
+		const auto vb = _mm_and_si128(
+			_mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i)), mask);
+		sum = _mm_add_epi64(sum, _mm_sad_epu8(va, vb));
+	}
+	return sum;
+}
+
+static std::uint32_t _row_sad_sse2(
+		const std::uint8_t *a, const std::uint8_t *b, std::size_t n) noexcept {
+	const auto sum = _row_sad_sse2_tail(a, b, n);
+	return std::uint32_t(_mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_srli_si128(sum, 8)));
+}
+
+static void _block_sads_sse2(
+		const std::uint8_t *image, std::size_t stride, const std::uint8_t *templ,
+		unsigned int tw, unsigned int th, std::uint16_t *sads) noexcept {
+	// One template pixel against 16 positions at a time, in 16-bit lanes.
+	const auto zero = _mm_setzero_si128();
+	__m128i sums[4] = {zero, zero, zero, zero};
+	for (unsigned int y = 0; y < th; y++, image += stride) {
+		for (unsigned int x = 0; x < tw; x++) {
+			const auto t = _mm_set1_epi8(static_cast<char>(*templ++));
+			for (int half = 0; half < 2; half++) {
+				const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(image + x + half * 16));
+				const auto d = _mm_or_si128(_mm_subs_epu8(v, t), _mm_subs_epu8(t, v));
+				sums[half * 2] = _mm_add_epi16(sums[half * 2], _mm_unpacklo_epi8(d, zero));
+				sums[half * 2 + 1] = _mm_add_epi16(sums[half * 2 + 1], _mm_unpackhi_epi8(d, zero));
+			}
+		}
+	}
+	for (int i = 0; i < 4; i++)
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(sads + i * 8), sums[i]);
+}
+
+#else // !VINPUT_IMAGE_SEARCH_SSE2
+
+static void _block_sads_scalar(
+		const std::uint8_t *image, std::size_t stride, const std::uint8_t *templ,
+		unsigned int tw, unsigned int th, std::uint16_t *sads) noexcept {
+	for (unsigned int i = 0; i < block_positions; i++) {
+		std::uint32_t sum = 0;
+		for (unsigned int y = 0; y < th; y++)
+			sum += _row_sad_scalar(image + y * stride + i, templ + y * tw, tw);
+		sads[i] = std::uint16_t(sum);
+	}
+}
+
+#endif // VINPUT_IMAGE_SEARCH_SSE2
+
+#if VINPUT_IMAGE_SEARCH_AVX2
+
+__attribute__((target("avx2")))
+static std::uint32_t _row_sad_avx2(
+		const std::uint8_t *a, const std::uint8_t *b, std::size_t n) noexcept {
+	__m256i sum = _mm256_setzero_si256();
+	std::size_t i = 0;
+	for (; i + 32 <= n; i += 32) {
+		const auto va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+		const auto vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+		sum = _mm256_add_epi64(sum, _mm256_sad_epu8(va, vb));
+	}
+	const auto sum128 = _mm_add_epi64(
+		_mm_add_epi64(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1)),
+		_row_sad_sse2_tail(a + i, b + i, n - i));
+	return std::uint32_t(
+		_mm_cvtsi128_si32(sum128) + _mm_cvtsi128_si32(_mm_srli_si128(sum128, 8)));
+}
+
+__attribute__((target("avx2")))
+static void _block_sads_avx2(
+		const std::uint8_t *image, std::size_t stride, const std::uint8_t *templ,
+		unsigned int tw, unsigned int th, std::uint16_t *sads) noexcept {
+	const auto zero = _mm256_setzero_si256();
+	__m256i sums_lo = zero, sums_hi = zero;
+	for (unsigned int y = 0; y < th; y++, image += stride) {
+		for (unsigned int x = 0; x < tw; x++) {
+			const auto t = _mm256_set1_epi8(static_cast<char>(*templ++));
+			const auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(image + x));
+			const auto d = _mm256_or_si256(_mm256_subs_epu8(v, t), _mm256_subs_epu8(t, v));
+			sums_lo = _mm256_add_epi16(sums_lo, _mm256_unpacklo_epi8(d, zero));
+			sums_hi = _mm256_add_epi16(sums_hi, _mm256_unpackhi_epi8(d, zero));
+		}
+	}
+	// Unpacking works in 128-bit lanes: positions 0-7, 16-23 | 8-15, 24-31.
+	_mm256_storeu_si256(
+		reinterpret_cast<__m256i *>(sads), _mm256_permute2x128_si256(sums_lo, sums_hi, 0x20));
+	_mm256_storeu_si256(
+		reinterpret_cast<__m256i *>(sads + 16), _mm256_permute2x128_si256(sums_lo, sums_hi, 0x31));
+}
+
+#endif // VINPUT_IMAGE_SEARCH_AVX2
+
+// Gray of 2x2 pixels from rows `s0` and `s1`, for `n` pixels of `d`.
+static void _halve_gray_row_scalar(
+		const std::uint32_t *s0, const std::uint32_t *s1, std::uint8_t *d, unsigned int n) noexcept {
+	for (unsigned int x = 0; x < n; x++) {
+		const auto p0 = s0[x * 2], p1 = s0[x * 2 + 1], p2 = s1[x * 2], p3 = s1[x * 2 + 1];
+		const auto channel = [=](int shift) {
+			return (p0 >> shift & 0xff) + (p1 >> shift & 0xff) +
+				(p2 >> shift & 0xff) + (p3 >> shift & 0xff);
+		};
+		d[x] = std::uint8_t((channel(16) * 77 + channel(8) * 150 + channel(0) * 29 + 512) >> 10);
+	}
+}
+
+// Like _halve_gray_row_scalar(), but for pixels of `d` in groups of 8 only.
+// Returns the number of pixels done.
+static unsigned int _halve_gray_row(
+		const std::uint32_t *s0, const std::uint32_t *s1, std::uint8_t *d, unsigned int n) noexcept {
+#if VINPUT_IMAGE_SEARCH_SSE2
+	const auto zero = _mm_setzero_si128();
+	const auto weights = _mm_setr_epi16(29, 150, 77, 0, 29, 150, 77, 0);
+	const auto rounding = _mm_set1_epi32(512);
+	// Two pixels of `d` from 4 pixels of each row, in 32-bit lanes 0 and 1.
+	const auto gray2 = [&](const std::uint32_t *a, const std::uint32_t *b) {
+		const auto va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a));
+		const auto vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b));
+		// Channels of columns 0, 1 and 2, 3 summed by rows in 16-bit lanes.
+		const auto lo = _mm_add_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero));
+		const auto hi = _mm_add_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero));
+		// And by columns: B G R 0 of the two pixels.
+		const auto sums = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+		const auto products = _mm_madd_epi16(sums, weights);
+		const auto gray = _mm_add_epi32(
+			products, _mm_shuffle_epi32(products, _MM_SHUFFLE(2, 3, 0, 1)));
+		return _mm_shuffle_epi32(
+			_mm_srli_epi32(_mm_add_epi32(gray, rounding), 10), _MM_SHUFFLE(3, 1, 2, 0));
+	};
+	unsigned int x = 0;
+	for (; x + 8 <= n; x += 8) {
+		const auto g0 = _mm_unpacklo_epi64(gray2(s0, s1), gray2(s0 + 4, s1 + 4));
+		const auto g1 = _mm_unpacklo_epi64(gray2(s0 + 8, s1 + 8), gray2(s0 + 12, s1 + 12));
+		const auto g = _mm_packs_epi32(g0, g1);
+		_mm_storel_epi64(reinterpret_cast<__m128i *>(d + x), _mm_packus_epi16(g, g));
+		s0 += 16;
+		s1 += 16;
+	}
+	return x;
+#else // !VINPUT_IMAGE_SEARCH_SSE2
+	_halve_gray_row_scalar(s0, s1, d, n);
+	return n;
+#endif // VINPUT_IMAGE_SEARCH_SSE2
+}
+
+static bool _use_avx2() noexcept {
+#if VINPUT_IMAGE_SEARCH_AVX2
+	__builtin_cpu_init(); // May run before the constructor doing it.
+	return __builtin_cpu_supports("avx2");
+#else // !VINPUT_IMAGE_SEARCH_AVX2
+	return false;
+#endif // VINPUT_IMAGE_SEARCH_AVX2
+}
+
+#if VINPUT_IMAGE_SEARCH_AVX2
+static const row_sad_func_t _row_sad = _use_avx2() ? &_row_sad_avx2 : &_row_sad_sse2;
+static const block_sads_func_t _block_sads = _use_avx2() ? &_block_sads_avx2 : &_block_sads_sse2;
+#elif VINPUT_IMAGE_SEARCH_SSE2
+static const row_sad_func_t _row_sad = &_row_sad_sse2;
+static const block_sads_func_t _block_sads = &_block_sads_sse2;
+#else
+static const row_sad_func_t _row_sad = &_row_sad_scalar;
+static const block_sads_func_t _block_sads = &_block_sads_scalar;
+#endif
+
+bool vinput::read_ppm_image(std::istream &source, Image &image) {
+	// Header: "P6", width, height and maximum value, separated by spaces,
+	// with comments from '#' to the end of line, and then one space.
+	char magic[2];
+	if (!source.read(magic, 2) || magic[0] != 'P' || magic[1] != '6')
+		return false;
+	unsigned int fields[3];
+	for (auto &field : fields) {
+		while (true) {
+			const auto c = source.peek();
+			if (c == '#')
+				source.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+			else if (c != std::istream::traits_type::eof() && std::isspace(c))
+				source.get();
+			else
+				break;
+		}
+		if (!(source >> field))
+			return false;
+	}
+	if (!std::isspace(source.get()))
+		return false;
+	const auto [width, height, max_value] = fields;
+	if (!width || !height || !max_value || max_value > 255 ||
+			width > ppm_pixels_limit / height)
+		return false;
+
+	std::vector<char> row(std::size_t(width) * 3);
+	image.width = width;
+	image.height = height;
+	image.pixels.resize(std::size_t(width) * height);
+	auto pixel = image.pixels.data();
+	for (unsigned int y = 0; y < height; y++) {
+		if (!source.read(row.data(), std::streamsize(row.size())))
+			return false;
+		for (std::size_t i = 0; i < row.size(); i += 3) {
+			const auto channel = [&row, max_value](std::size_t j) {
+				return std::uint32_t(static_cast<unsigned char>(row[j])) * 255 / max_value;
+			};
+			*pixel++ = channel(i) << 16 | channel(i + 1) << 8 | channel(i + 2);
+		}
+	}
+	return true;
+}
+
+void ImageSearch::Level::resize(unsigned int w, unsigned int h) {
+	this->width = w;
+	this->height = h;
+	this->data.resize(std::size_t(w) * h + level_padding);
+}
+
+ImageSearch::View ImageSearch::Level::view() const noexcept {
+	return {this->data.data(), this->width, this->width, this->height, 1, true};
+}
+
+ImageSearch::ImageSearch(const Image &templ) : templ(templ) {
+	// Halve while the template stays large enough to tell places apart.
+	unsigned int levels = 1;
+	while (levels < MAX_LEVELS &&
+			(templ.width >> levels) >= MIN_TOP_SIZE && (templ.height >> levels) >= MIN_TOP_SIZE)
+		levels++;
+	this->templ_levels.resize(levels - 1);
+	this->image_levels.resize(levels - 1);
+	for (unsigned int i = 0; i + 1 < levels; i++) {
+		if (i)
+			ImageSearch::halve(this->templ_levels[i], this->templ_levels[i - 1]);
+		else
+			ImageSearch::halve(this->templ_levels[i], this->templ.pixels.data(), templ.width, templ.height);
+	}
+}
+
+std::pair<ImageSearch::Match, bool> ImageSearch::find(
+		const std::uint32_t *pixels, unsigned int width, unsigned int height,
+		unsigned int tolerance) {
+	if (width < this->templ.width || height < this->templ.height || !this->templ.width)
+		return {{0, 0}, false};
+
+	const auto color_image = ImageSearch::color_view(pixels, width, height);
+	const auto color_templ =
+		ImageSearch::color_view(this->templ.pixels.data(), this->templ.width, this->templ.height);
+	const auto levels = this->templ_levels.size();
+	if (levels) {
+		for (std::size_t i = 0; i < levels; i++) {
+			if (i)
+				ImageSearch::halve(this->image_levels[i], this->image_levels[i - 1]);
+			else
+				ImageSearch::halve(this->image_levels[i], pixels, width, height);
+		}
+		this->search_top(this->image_levels.back().view(), this->templ_levels.back().view());
+		for (auto i = levels - 1; i > 0; i--)
+			this->refine(this->image_levels[i - 1].view(), this->templ_levels[i - 1].view());
+		// Only the best few are compared in color, which costs the most.
+		if (this->candidates.size() > COLOR_CANDIDATES)
+			this->candidates.resize(COLOR_CANDIDATES);
+		this->refine(color_image, color_templ, true);
+	} else {
+		// Too small to halve.
+		this->search_top(color_image, color_templ);
+	}
+
+	if (this->candidates.empty())
+		return {{0, 0}, false};
+	const auto &best = this->candidates.front();
+	if (best.sad > std::uint64_t(tolerance) * 3 * this->templ.pixels.size())
+		return {{0, 0}, false};
+	return {{best.x, best.y}, true};
+}
+
+ImageSearch::View ImageSearch::color_view(
+		const std::uint32_t *pixels, unsigned int width, unsigned int height) noexcept {
+	// The fourth bytes of pixels are all 0, and add nothing to SADs.
+	return {
+		reinterpret_cast<const std::uint8_t *>(pixels), std::size_t(width) * 4,
+		width, height, 4, false,
+	};
+}
+
+// Gray image of half the size, straight from pixels.
+void ImageSearch::halve(
+		Level &dst, const std::uint32_t *pixels, unsigned int width, unsigned int height) {
+	dst.resize(width / 2, height / 2);
+	for (unsigned int y = 0; y < dst.height; y++) {
+		const auto s0 = pixels + std::size_t(y) * 2 * width, s1 = s0 + width;
+		auto *const d = dst.data.data() + std::size_t(y) * dst.width;
+		const auto x = _halve_gray_row(s0, s1, d, dst.width);
+		_halve_gray_row_scalar(s0 + x * 2, s1 + x * 2, d + x, dst.width - x);
+	}
+}
+
+void ImageSearch::halve(Level &dst, const Level &src) {
+	dst.resize(src.width / 2, src.height / 2);
+	for (unsigned int y = 0; y < dst.height; y++) {
+		const auto s0 = src.data.data() + std::size_t(y) * 2 * src.width, s1 = s0 + src.width;
+		auto *const d = dst.data.data() + std::size_t(y) * dst.width;
+		for (unsigned int x = 0; x < dst.width; x++)
+			d[x] = std::uint8_t((s0[x * 2] + s0[x * 2 + 1] + s1[x * 2] + s1[x * 2 + 1] + 2) >> 2);
+	}
+}
+
+// Sum of absolute differences at the position, or some sum no less than
+// `limit` if it is reached.
+std::uint64_t ImageSearch::sad(
+		const View &image, const View &templ, unsigned int x, unsigned int y,
+		std::uint64_t limit) noexcept {
+	const auto row_size = std::size_t(templ.width) * templ.pixel_size;
+	// Whole vectors only, if nothing may be loaded after the rows.
+	const auto vector_size = image.padded ? row_size : row_size & ~std::size_t(15);
+	const auto *image_row = image.data + y * image.stride + std::size_t(x) * image.pixel_size;
+	const auto *templ_row = templ.data;
+	std::uint64_t sum = 0;
+	for (unsigned int i = 0; i < templ.height && sum < limit; i++) {
+		sum += _row_sad(image_row, templ_row, vector_size);
+		if (vector_size < row_size)
+			sum += _row_sad_scalar(
+				image_row + vector_size, templ_row + vector_size, row_size - vector_size);
+		image_row += image.stride;
+		templ_row += templ.stride;
+	}
+	return sum;
+}
+
+void ImageSearch::search_top(const View &image, const View &templ) {
+	this->candidates.clear();
+	const auto max_x = image.width - templ.width;
+	const auto limit = [this] {
+		return this->candidates.size() < TOP_CANDIDATES ?
+			std::numeric_limits<std::uint64_t>::max() : this->candidates.back().sad;
+	};
+
+	// Usually the template is small on the top level, and positions are
+	// compared in blocks.
+	if (image.padded && image.pixel_size == 1 &&
+			std::size_t(templ.width) * templ.height <= 257) {
+		std::uint16_t sads[block_positions];
+		for (unsigned int y = 0; y + templ.height <= image.height; y++) {
+			for (unsigned int x0 = 0; x0 <= max_x; x0 += block_positions) {
+				_block_sads(
+					image.data + y * image.stride + x0, image.stride, templ.data,
+					templ.width, templ.height, sads);
+				const auto n = std::min(block_positions, max_x - x0 + 1);
+				for (unsigned int i = 0; i < n; i++) {
+					if (sads[i] < limit())
+						this->add_candidate({sads[i], x0 + i, y}, templ);
+				}
+			}
+		}
+		return;
+	}
+
+	for (unsigned int y = 0; y + templ.height <= image.height; y++) {
+		for (unsigned int x = 0; x <= max_x; x++) {
+			const auto l = limit();
+			if (const auto sum = ImageSearch::sad(image, templ, x, y, l); sum < l)
+				this->add_candidate({sum, x, y}, templ);
+		}
+	}
+}
+
+// Keep the best candidates, not closer than half the template to each
+// other, so that flat areas do not take all the places.
+void ImageSearch::add_candidate(Candidate c, const View &templ) noexcept {
+	const auto close = [&templ, &c](const Candidate &other) {
+		const auto dx = c.x > other.x ? c.x - other.x : other.x - c.x;
+		const auto dy = c.y > other.y ? c.y - other.y : other.y - c.y;
+		return dx * 2 < templ.width && dy * 2 < templ.height;
+	};
+	const auto by_sad = [](const Candidate &a, const Candidate &b) { return a.sad < b.sad; };
+
+	auto &list = this->candidates;
+	if (const auto iter = std::find_if(list.begin(), list.end(), close); iter != list.end()) {
+		if (c.sad >= iter->sad)
+			return;
+		list.erase(iter);
+	} else if (list.size() >= TOP_CANDIDATES) {
+		list.pop_back();
+	}
+	list.insert(std::upper_bound(list.begin(), list.end(), c, by_sad), c);
+}
+
+// Move the candidates one level down, each to the best place near it. If
+// `best_only`, only the first candidate is sure to be right after sorting.
+void ImageSearch::refine(const View &image, const View &templ, bool best_only) noexcept {
+	constexpr int radius = 2;
+	constexpr auto none = std::numeric_limits<std::uint64_t>::max();
+	const auto max_x = int(image.width - templ.width), max_y = int(image.height - templ.height);
+	auto best_sad = none;
+	for (auto &c : this->candidates) {
+		const int cx = std::min(int(c.x * 2), max_x), cy = std::min(int(c.y * 2), max_y);
+		// The middle first, as it is the most likely to be the best.
+		Candidate best = {
+			ImageSearch::sad(image, templ, unsigned(cx), unsigned(cy), best_only ? best_sad : none),
+			unsigned(cx), unsigned(cy)};
+		for (int y = std::max(cy - radius, 0); y <= std::min(cy + radius, max_y); y++) {
+			for (int x = std::max(cx - radius, 0); x <= std::min(cx + radius, max_x); x++) {
+				if (x == cx && y == cy)
+					continue;
+				const auto limit = std::min(best.sad, best_only ? best_sad : none);
+				if (const auto sum = ImageSearch::sad(image, templ, unsigned(x), unsigned(y), limit);
+						sum < limit)
+					best = {sum, unsigned(x), unsigned(y)};
+			}
+		}
+		// Sums stop growing at the limit, so only lower ones are exact.
+		if (best_only && best.sad >= best_sad)
+			best.sad = none;
+		c = best;
+		best_sad = std::min(best_sad, best.sad);
+	}
+	std::sort(
+		this->candidates.begin(), this->candidates.end(),
+		[](const Candidate &a, const Candidate &b) { return a.sad < b.sad; });
+}
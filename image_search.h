@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <utility>
+#include <vector>
+
+namespace vinput {
+
+// Image of 0x00RRGGBB pixels, row by row.
+struct Image {
+	unsigned int width = 0, height = 0;
+	std::vector<std::uint32_t> pixels;
+};
+
+// Read a binary PPM ("P6") image with up to 8 bits per channel.
+// Returns false if the data is not such an image.
+bool read_ppm_image(std::istream &source, Image &image);
+
+// Finds a template image in larger ones, like screenshots. Both are halved
+// in size level by level to gray pyramids. All positions are compared on the
+// top level, and then the best candidates are moved to the best place near
+// them on each lower level, ending with the fewer best at full size in color.
+// Places are compared by sums of absolute differences (SAD), with SSE2 or AVX2.
+class ImageSearch {
+public:
+	// Position of the top-left corner of a match.
+	struct Match {
+		unsigned int x, y;
+	};
+
+	// The template is copied.
+	explicit ImageSearch(const Image &templ);
+
+	// Find the template in the image of `width` x `height` pixels. The best
+	// match is accepted if the channels differ by no more than `tolerance`
+	// on average.
+	std::pair<Match, bool> find(
+		const std::uint32_t *pixels, unsigned int width, unsigned int height,
+		unsigned int tolerance);
+
+private:
+	// Pixels of an image as bytes.
+	struct View {
+		const std::uint8_t *data;
+		std::size_t stride; // Bytes per row.
+		unsigned int width, height;
+		unsigned int pixel_size; // In bytes.
+		bool padded; // Whether vectors can be loaded from anywhere in it.
+	};
+
+	// Gray image, with padding at the end.
+	struct Level {
+		unsigned int width, height;
+		std::vector<std::uint8_t> data;
+
+		void resize(unsigned int w, unsigned int h);
+		View view() const noexcept;
+	};
+
+	struct Candidate {
+		std::uint64_t sad;
+		unsigned int x, y;
+	};
+
+	static constexpr unsigned int MAX_LEVELS = 5; // Including the full size one.
+	static constexpr unsigned int MIN_TOP_SIZE = 4; // Of the template on the top level.
+	static constexpr std::size_t TOP_CANDIDATES = 32;
+	static constexpr std::size_t COLOR_CANDIDATES = 16; // Of the full size level.
+
+	Image templ;
+	std::vector<Level> templ_levels; // Halved 1, 2, ... times.
+	std::vector<Level> image_levels; // Likewise. Reused by find().
+	std::vector<Candidate> candidates; // Sorted by SAD.
+
+	static View color_view(
+		const std::uint32_t *pixels, unsigned int width, unsigned int height) noexcept;
+	static void halve(
+		Level &dst, const std::uint32_t *pixels, unsigned int width, unsigned int height);
+	static void halve(Level &dst, const Level &src);
+	static std::uint64_t sad(
+		const View &image, const View &templ, unsigned int x, unsigned int y,
+		std::uint64_t limit) noexcept;
+
+	void search_top(const View &image, const View &templ);
+	void add_candidate(Candidate c, const View &templ) noexcept;
+	void refine(const View &image, const View &templ, bool best_only = false) noexcept;
+};
+
+}
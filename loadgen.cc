@@ -0,0 +1,284 @@
+#if VINPUT_DESKTOP_LINUX
+
+#include "loadgen.h"
+
+#include <algorithm>
+#include <atomic>
+#include <barrier>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <exception>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "desktop.h"
+#include "desktops.h"
+#include "prints.h"
+
+using namespace vinput;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct LoadDevice {
+	Desktop *desktop = nullptr;
+	std::vector<float> latencies_us; // Of actions, up to LATENCY_SAMPLES.
+	float max_latency_us = 0;
+	std::size_t actions = 0;
+	LinuxDesktopStats stats = { };
+	double seconds = 0; // Time spent by the worker.
+	Clock::time_point action_time; // When the last action started.
+	bool failed = false;
+};
+
+constexpr std::size_t LATENCY_SAMPLES = 1 << 20;
+constexpr std::size_t RING_ENTRIES = 4096; // At most, of the ring of a worker.
+
+// Key clicks through the lower case letters. Four events each, with reports.
+constexpr auto WORKLOAD_KEY_FIRST = std::size_t(Desktop::Key::a);
+constexpr auto WORKLOAD_KEY_COUNT = std::size_t(26);
+
+}
+
+// Latency of the action last started on the device, which has completed.
+static void record_action(LoadDevice &dev, Clock::time_point done_time) noexcept {
+	const float latency_us =
+		std::chrono::duration<float, std::micro>(done_time - dev.action_time).count();
+	if (dev.latencies_us.size() < LATENCY_SAMPLES)
+		dev.latencies_us.push_back(latency_us);
+	dev.max_latency_us = std::max(dev.max_latency_us, latency_us);
+	dev.actions++;
+}
+
+static void pin_thread(unsigned int index) noexcept {
+	const auto cpu_count = std::max(std::thread::hardware_concurrency(), 1u);
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	CPU_SET(index % cpu_count, &cpus);
+	if (pthread_setaffinity_np(pthread_self(), sizeof cpus, &cpus))
+		print_warning("cannot pin load worker %u", index);
+}
+
+static Desktop *connect_load_device(LinuxDesktopRing *ring) {
+	const int fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+	return connect_linux_desktop(fd, -1, ring);
+}
+
+static void run_load_worker(
+		unsigned int index, unsigned int stride, const LoadOptions &options,
+		const std::function<Desktop *()> &connect, bool io_uring,
+		std::vector<LoadDevice> &devices, std::atomic_size_t &created,
+		std::barrier<> &start_barrier) noexcept {
+	pin_thread(index);
+
+	// All devices of the worker share one ring, which writes the events of a
+	// round of actions on them together.
+	LinuxDesktopRing *ring = nullptr;
+	if (io_uring && !connect) {
+		const auto own_count = (devices.size() - index + stride - 1) / stride;
+		ring = create_linux_desktop_ring(
+			unsigned(std::clamp(own_count, std::size_t(8), RING_ENTRIES)));
+		if (!ring)
+			print_warning("io_uring not available, fall back to write()");
+	}
+
+	// Each worker creates its share of the devices, without waiting for each
+	// to settle; they all settle together afterwards.
+	std::vector<LoadDevice *> own_devices;
+	for (auto i = std::size_t(index); i < devices.size(); i += stride) {
+		auto &dev = devices[i];
+		try {
+			dev.desktop = connect ? connect() : connect_load_device(ring);
+			dev.latencies_us.reserve(std::min(LATENCY_SAMPLES, std::size_t(1) << 16));
+			own_devices.push_back(&dev);
+		} catch (const std::exception &e) {
+			print_error(e);
+			dev.failed = true;
+		}
+	}
+	created += own_devices.size();
+	if (!connect)
+		std::this_thread::sleep_for(std::chrono::milliseconds(LINUX_DESKTOP_SETTLE_MS));
+	start_barrier.arrive_and_wait();
+	if (own_devices.empty()) {
+		destroy_linux_desktop_ring(ring);
+		return;
+	}
+
+	const auto start_time = Clock::now();
+	const auto end_time = start_time + std::chrono::duration_cast<Clock::duration>(
+		std::chrono::duration<double>(options.duration));
+	// The share of the rate by devices, as some may have failed to be created.
+	const double worker_rate = options.rate * double(own_devices.size()) / double(created);
+	const auto max_lag = std::chrono::milliseconds(100);
+	auto due_time = start_time;
+
+	// Rounds of one action on every device that is still alive.
+	std::vector<LoadDevice *> alive_devices = own_devices;
+	for (std::size_t round = 0; !alive_devices.empty(); round++) {
+		const auto now = Clock::now();
+		if (now >= end_time)
+			break;
+		if (worker_rate > 0) {
+			// Hold the rate, but do not burst to catch up with a long stall.
+			if (due_time > now)
+				std::this_thread::sleep_until(due_time);
+			else if (now - due_time > max_lag)
+				due_time = now - max_lag;
+		}
+
+		const auto key = static_cast<Desktop::Key>(
+			WORKLOAD_KEY_FIRST + round % WORKLOAD_KEY_COUNT);
+		for (std::size_t i = 0; i < alive_devices.size(); ) {
+			auto &dev = *alive_devices[i];
+			dev.action_time = Clock::now();
+			try {
+				dev.desktop->key(key, Desktop::PressAction::Press);
+				dev.desktop->key(key, Desktop::PressAction::Release);
+				dev.desktop->flush();
+			} catch (const std::exception &e) {
+				print_error(e);
+				dev.failed = true;
+				alive_devices.erase(alive_devices.begin() + std::ptrdiff_t(i));
+				continue;
+			}
+			// Without a ring, the events have been written.
+			if (!ring)
+				record_action(dev, Clock::now());
+			i++;
+		}
+		if (ring) {
+			linux_desktop_ring_submit(*ring);
+			const auto done_time = Clock::now();
+			for (const auto dev : alive_devices)
+				record_action(*dev, done_time);
+		}
+
+		if (worker_rate > 0) {
+			std::size_t events = 0;
+			for (const auto dev : alive_devices) {
+				const auto written = linux_desktop_stats(*dev->desktop).written;
+				events += written - dev->stats.written;
+				dev->stats.written = written;
+			}
+			due_time += std::chrono::duration_cast<Clock::duration>(
+				std::chrono::duration<double>(double(events ? events : 1) / worker_rate));
+		}
+	}
+
+	const double seconds = std::chrono::duration<double>(Clock::now() - start_time).count();
+	for (const auto dev : own_devices) {
+		try {
+			dev->desktop->flush();
+		} catch (const std::exception &) {
+			dev->failed = true;
+		}
+		dev->seconds = seconds;
+	}
+	if (ring)
+		linux_desktop_ring_submit(*ring);
+	for (const auto dev : own_devices)
+		dev->stats = linux_desktop_stats(*dev->desktop);
+	// Let the last events be handled before the devices go.
+	if (!connect)
+		std::this_thread::sleep_for(std::chrono::milliseconds(LINUX_DESKTOP_SETTLE_MS));
+	for (const auto dev : own_devices) {
+		disconnect_desktop(dev->desktop);
+		dev->desktop = nullptr;
+	}
+	destroy_linux_desktop_ring(ring);
+}
+
+static float percentile(std::vector<float> &samples, double p) noexcept {
+	if (samples.empty())
+		return 0;
+	const auto nth = samples.begin() + std::ptrdiff_t(double(samples.size() - 1) * p);
+	std::nth_element(samples.begin(), nth, samples.end());
+	return *nth;
+}
+
+static bool report_load(
+		const LoadOptions &options, unsigned int thread_count,
+		std::vector<LoadDevice> &devices) noexcept {
+	auto &out = cout();
+	char buffer[160];
+	int n;
+
+	n = std::snprintf(
+		buffer, sizeof buffer,
+		"load: %zu devices, %u threads, target %.0f events/s, %.1f s\n"
+		"%6s %12s %10s %10s %10s %10s %10s %8s %8s\n",
+		devices.size(), thread_count, options.rate, options.duration,
+		"device", "events", "events/s", "actions/s", "p50-us", "p99-us", "max-us",
+		"retried", "dropped"
+	);
+	out.write(buffer, std::min(std::size_t(n), sizeof buffer - 1));
+
+	bool ok = true;
+	double total_rate = 0;
+	std::size_t total_events = 0;
+	for (std::size_t i = 0; i < devices.size(); i++) {
+		auto &dev = devices[i];
+		if (dev.failed || dev.stats.dropped)
+			ok = false;
+		const auto seconds = dev.seconds > 0 ? dev.seconds : 1;
+		const auto rate = double(dev.stats.written) / seconds;
+		total_rate += rate;
+		total_events += dev.stats.written;
+		n = std::snprintf(
+			buffer, sizeof buffer,
+			"%6zu %12zu %10.0f %10.0f %10.1f %10.1f %10.1f %8zu %8zu%s\n",
+			i, dev.stats.written, rate, double(dev.actions) / seconds,
+			percentile(dev.latencies_us, 0.5), percentile(dev.latencies_us, 0.99),
+			dev.max_latency_us, dev.stats.retried, dev.stats.dropped,
+			dev.failed ? " failed" : ""
+		);
+		out.write(buffer, std::min(std::size_t(n), sizeof buffer - 1));
+	}
+	n = std::snprintf(
+		buffer, sizeof buffer, "%6s %12zu %10.0f\n", "total", total_events, total_rate);
+	out.write(buffer, std::min(std::size_t(n), sizeof buffer - 1));
+	out.flush();
+	return ok;
+}
+
+bool vinput::run_load(
+		const LoadOptions &options, const std::function<Desktop *()> &connect) {
+	if (!options.devices)
+		return true;
+	// Restored after the devices are gone, not to affect other desktops.
+	const auto saved_options = linux_desktop_options;
+	// Workers share rings among their devices, instead of one for each.
+	const bool io_uring = linux_desktop_options.io_uring;
+	linux_desktop_options.io_uring = false;
+	if (!connect) {
+		linux_desktop_options.composite = true;
+		linux_desktop_options.settle = false;
+	}
+
+	const auto cpu_count = std::max(std::thread::hardware_concurrency(), 1u);
+	const auto thread_count =
+		std::min(options.threads ? options.threads : cpu_count, options.devices);
+	std::vector<LoadDevice> devices(options.devices);
+	std::atomic_size_t created = 0;
+	std::barrier<> start_barrier(thread_count);
+	std::vector<std::thread> threads;
+	for (unsigned int i = 0; i < thread_count; i++) {
+		threads.emplace_back(
+			run_load_worker, i, thread_count, std::cref(options), std::cref(connect), io_uring,
+			std::ref(devices), std::ref(created), std::ref(start_barrier));
+	}
+	for (auto &thread : threads)
+		thread.join();
+	linux_desktop_options = saved_options;
+	return report_load(options, thread_count, devices);
+}
+
+#endif // VINPUT_DESKTOP_LINUX
@@ -0,0 +1,29 @@
+#pragma once
+
+#if VINPUT_DESKTOP_LINUX
+
+#include <functional>
+
+namespace vinput {
+
+class Desktop;
+
+// Options of the load generator.
+struct LoadOptions {
+	unsigned int devices = 1; // Number of uinput devices.
+	unsigned int threads = 0; // Worker threads, pinned to cores. 0 for one per core.
+	double rate = 0; // Target aggregate events per second. 0 for unlimited.
+	double duration = 10; // Seconds.
+};
+
+// Create the devices and type on them from worker threads until the time is
+// up, then print the achieved event rate and the per-device latency of
+// sending an action. Devices are created with `connect` (composite uinput
+// devices if empty). With io_uring, each worker writes a round of actions
+// on its devices together, and latencies last until the round is written.
+// Returns false if any device failed.
+bool run_load(const LoadOptions &options, const std::function<Desktop *()> &connect = { });
+
+}
+
+#endif // VINPUT_DESKTOP_LINUX
@@ -1,32 +1,120 @@
+#include <algorithm>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <fstream>
 #include <iostream>
 #include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
 
 #include "argparse.h"
+#include "daemon.h"
+#include "desktop.h"
 #include "desktops.h"
+#include "loadgen.h"
 #include "prints.h"
 #include "script.h"
 
 using namespace vinput;
 
-static void parse_args(int argc, char *argv[], Desktop *&desktop, Script &script);
+namespace {
+
+enum class RunMode {
+	PLAY,
+	DAEMON,
+	CLIENT,
+	LOAD,
+};
+
+}
+
+// Exit status when events diverged from the expected trace.
+static constexpr int EXIT_DIVERGED = 3;
+
+#if VINPUT_DESKTOP_LINUX
+static LoadOptions load_options;
+#endif // VINPUT_DESKTOP_LINUX
+
+static void parse_args(
+	int argc, char *argv[],
+	RunMode &mode, std::string &socket_path,
+	std::vector<Desktop *> &desktops, Script &script);
+
+// Play the script on the desktop. Returns the exit status.
+static int play(const Script &script, Desktop &desktop) noexcept {
+	try {
+		script.play(desktop);
+		verify_desktop_finish(desktop);
+		return EXIT_SUCCESS;
+	} catch (const TraceDivergedError &e) {
+		print_error(e);
+		return EXIT_DIVERGED;
+	} catch (const std::exception &e) {
+		print_error(e);
+		return EXIT_FAILURE;
+	}
+}
+
+// Play the script on each desktop in its own thread. Returns the exit status.
+static int play_concurrently(
+		const Script &script, const std::vector<Desktop *> &desktops) {
+	if (desktops.size() == 1)
+		return play(script, *desktops.front());
+
+	std::vector<std::thread> threads;
+	std::vector<int> statuses(desktops.size(), EXIT_SUCCESS);
+	for (std::size_t i = 0; i < desktops.size(); i++) {
+		threads.emplace_back([&script, desktop = desktops[i], &status = statuses[i]] {
+			status = play(script, *desktop);
+		});
+	}
+	for (auto &thread : threads)
+		thread.join();
+	return *std::max_element(statuses.begin(), statuses.end());
+}
 
 int main(int argc, char *argv[]) {
 	int exit_status = EXIT_SUCCESS;
-	Desktop *desktop = nullptr;
+	RunMode mode = RunMode::PLAY;
+	std::string socket_path;
+	std::vector<Desktop *> desktops;
 	Script script;
 
 	try {
-		parse_args(argc, argv, desktop, script);
-		script.play(*desktop);
+		parse_args(argc, argv, mode, socket_path, desktops, script);
+		switch (mode) {
+		case RunMode::PLAY:
+			exit_status = play_concurrently(script, desktops);
+			break;
+#if VINPUT_DESKTOP_LINUX
+		case RunMode::LOAD:
+			if (!run_load(load_options))
+				exit_status = EXIT_FAILURE;
+			break;
+#endif // VINPUT_DESKTOP_LINUX
+#ifndef _WIN32
+		case RunMode::DAEMON:
+			if (desktops.size() != 1)
+				throw DesktopBaseError("vinput", "daemon mode takes one desktop");
+			run_daemon(*desktops.front(), socket_path.c_str());
+			break;
+		case RunMode::CLIENT:
+			if (!run_client(script, socket_path.c_str()))
+				exit_status = EXIT_FAILURE;
+			break;
+#endif // !_WIN32
+		default:
+			break;
+		}
 	} catch (const std::exception &e) {
 		print_error(e);
 		exit_status = EXIT_FAILURE;
 	}
 
-	if (desktop)
+	for (const auto desktop : desktops)
 		disconnect_desktop(desktop);
 
 	return exit_status;
@@ -37,8 +125,13 @@ static void print_program_help() noexcept;
 namespace {
 
 struct ArgParseContext {
-	Desktop *&desktop;
+	RunMode &mode;
+	std::string &socket_path;
 	Script &script;
+	bool test;
+	const char *desktop_name;
+	const char *window;
+	std::vector<const char *> displays;
 };
 
 }
@@ -53,11 +146,43 @@ static int oh_help_script(void *, const argparse_option_t *, const char *) noexc
 	std::exit(EXIT_SUCCESS);
 }
 
-static int oh_test(void *data, const argparse_option_t *, const char *) noexcept {
-	auto &desktop = static_cast<ArgParseContext *>(data)->desktop;
-	if (desktop)
-		disconnect_desktop(desktop);
-	desktop = connect_test_desktop();
+static int oh_list_desktops(void *, const argparse_option_t *, const char *) noexcept {
+	std::cout << desktop_names() << std::endl;
+	std::exit(EXIT_SUCCESS);
+}
+
+static int oh_test(void *data, const argparse_option_t *, const char *arg) noexcept {
+	static_cast<ArgParseContext *>(data)->test = true;
+	if (!arg)
+		return 0;
+
+	const std::string_view arg_sv(arg);
+	const auto format = arg_sv.substr(0, arg_sv.find(':'));
+	if (format == "text") {
+		test_desktop_options.format = TestDesktopOptions::TEXT;
+	} else if (format == "jsonl") {
+		test_desktop_options.format = TestDesktopOptions::JSONL;
+	} else if (format == "binary") {
+		test_desktop_options.format = TestDesktopOptions::BINARY;
+	} else {
+		std::cerr << "vinput: error: unknown output format: " << format << std::endl;
+		std::exit(EXIT_FAILURE);
+	}
+	if (format.size() < arg_sv.size())
+		test_desktop_options.path = arg_sv.substr(format.size() + 1);
+	return 0;
+}
+
+static int oh_desktop(
+		void *data, const argparse_option_t *, const char *arg) noexcept {
+	static_cast<ArgParseContext *>(data)->desktop_name = arg;
+	return 0;
+}
+
+static int oh_verify(
+		void *data, const argparse_option_t *, const char *arg) noexcept {
+	verify_desktop_options.path = arg;
+	static_cast<ArgParseContext *>(data)->desktop_name = "verify";
 	return 0;
 }
 
@@ -75,12 +200,157 @@ static int oh_no_rand_sleep(
 	return 0;
 }
 
+static int oh_window(
+		void *data, const argparse_option_t *, const char *arg) noexcept {
+	static_cast<ArgParseContext *>(data)->window = arg;
+	return 0;
+}
+
+static int oh_real_time(void *, const argparse_option_t *, const char *) noexcept {
+	test_desktop_options.real_time = true;
+	return 0;
+}
+
+static int oh_poll_interval(
+		void *, const argparse_option_t *, const char *arg) noexcept {
+	char end;
+	if (std::sscanf(arg, "%u%c", &Script::poll_interval_ms, &end) != 1 ||
+			!Script::poll_interval_ms) {
+		std::cerr << "vinput: error: invalid poll interval: " << arg << std::endl;
+		std::exit(EXIT_FAILURE);
+	}
+	return 0;
+}
+
+static int oh_pace(
+		void *, const argparse_option_t *, const char *arg) noexcept {
+	unsigned int min_ms, max_ms;
+	char end;
+	if (std::sscanf(arg, "%u%c", &min_ms, &end) == 1) {
+		max_ms = min_ms;
+	} else if (std::sscanf(arg, "%u,%u%c", &min_ms, &max_ms, &end) != 2 || min_ms > max_ms) {
+		std::cerr << "vinput: error: invalid pace: " << arg << std::endl;
+		std::exit(EXIT_FAILURE);
+	}
+	Script::pace_min_ms = min_ms;
+	Script::pace_max_ms = max_ms;
+	return 0;
+}
+
 static int oh_no_ignore_space(
 		void *, const argparse_option_t *, const char *) noexcept {
 	Script::ignore_space = false;
 	return 0;
 }
 
+#if VINPUT_DESKTOP_LINUX
+
+static int oh_screen_size(
+		void *, const argparse_option_t *, const char *arg) noexcept {
+	unsigned int width, height;
+	char end;
+	if (std::sscanf(arg, "%ux%u%c", &width, &height, &end) != 2 || !width || !height) {
+		std::cerr << "vinput: error: invalid screen size: " << arg << std::endl;
+		std::exit(EXIT_FAILURE);
+	}
+	linux_desktop_options.screen_width = width;
+	linux_desktop_options.screen_height = height;
+	return 0;
+}
+
+static int oh_uinput_composite(
+		void *, const argparse_option_t *, const char *) noexcept {
+	linux_desktop_options.composite = true;
+	return 0;
+}
+
+static int oh_uinput_io_uring(
+		void *, const argparse_option_t *, const char *) noexcept {
+	linux_desktop_options.io_uring = true;
+	return 0;
+}
+
+static int oh_load(void *data, const argparse_option_t *, const char *arg) noexcept {
+	char end;
+	if (std::sscanf(arg, "%u%c", &load_options.devices, &end) != 1 || !load_options.devices) {
+		std::cerr << "vinput: error: invalid number of devices: " << arg << std::endl;
+		std::exit(EXIT_FAILURE);
+	}
+	static_cast<ArgParseContext *>(data)->mode = RunMode::LOAD;
+	return 0;
+}
+
+static int oh_load_threads(
+		void *, const argparse_option_t *, const char *arg) noexcept {
+	char end;
+	if (std::sscanf(arg, "%u%c", &load_options.threads, &end) != 1) {
+		std::cerr << "vinput: error: invalid number of threads: " << arg << std::endl;
+		std::exit(EXIT_FAILURE);
+	}
+	return 0;
+}
+
+static int oh_load_rate(void *, const argparse_option_t *, const char *arg) noexcept {
+	char end;
+	if (std::sscanf(arg, "%lf%c", &load_options.rate, &end) != 1 || !(load_options.rate >= 0)) {
+		std::cerr << "vinput: error: invalid rate: " << arg << std::endl;
+		std::exit(EXIT_FAILURE);
+	}
+	return 0;
+}
+
+static int oh_load_time(void *, const argparse_option_t *, const char *arg) noexcept {
+	char end;
+	if (std::sscanf(arg, "%lf%c", &load_options.duration, &end) != 1 ||
+			!(load_options.duration > 0)) {
+		std::cerr << "vinput: error: invalid time: " << arg << std::endl;
+		std::exit(EXIT_FAILURE);
+	}
+	return 0;
+}
+
+#endif // VINPUT_DESKTOP_LINUX
+
+#if VINPUT_DESKTOP_X11 || VINPUT_DESKTOP_XCB
+
+static int oh_display(
+		void *data, const argparse_option_t *, const char *arg) noexcept {
+	static_cast<ArgParseContext *>(data)->displays.push_back(arg);
+	return 0;
+}
+
+#endif // VINPUT_DESKTOP_X11 || VINPUT_DESKTOP_XCB
+
+#if VINPUT_DESKTOP_X11
+
+static int oh_x11_xtest_keys(
+		void *, const argparse_option_t *, const char *) noexcept {
+	x11_desktop_options.xtest_keys = true;
+	return 0;
+}
+
+#endif // VINPUT_DESKTOP_X11
+
+#ifndef _WIN32
+
+static int oh_daemon(void *data, const argparse_option_t *, const char *) noexcept {
+	static_cast<ArgParseContext *>(data)->mode = RunMode::DAEMON;
+	return 0;
+}
+
+static int oh_client(void *data, const argparse_option_t *, const char *) noexcept {
+	static_cast<ArgParseContext *>(data)->mode = RunMode::CLIENT;
+	return 0;
+}
+
+static int oh_socket(
+		void *data, const argparse_option_t *, const char *arg) noexcept {
+	static_cast<ArgParseContext *>(data)->socket_path = arg;
+	return 0;
+}
+
+#endif // !_WIN32
+
 static int oh_file(
 		void *data, const argparse_option_t *, const char *arg) noexcept {
 	auto &script = static_cast<ArgParseContext *>(data)->script;
@@ -106,13 +376,61 @@ static int oh_file(
 static const argparse_option_t options[] = {
 	{'h', "help", nullptr, "print help message and exit", oh_help},
 	{0, "help-script", nullptr, "print script syntax and exit", oh_help_script},
-	{'t', "test", nullptr, "print instructions instead of executing them", oh_test},
+	{'t', "test", "[=FORMAT:PATH]",
+		"print instructions instead of executing them; "
+		"FORMAT is text (default), jsonl or binary; PATH defaults to stdout", oh_test},
+	{'D', "desktop", "NAME",
+		"desktop to use instead of the current one; see --list-desktops", oh_desktop},
+	{0, "list-desktops", nullptr, "print names of available desktops and exit", oh_list_desktops},
+	{0, "verify", "PATH",
+		"compare events with the trace in PATH (written by --test=binary:PATH) "
+		"and stop at the first difference, exiting with status 3", oh_verify},
 	{'p', "trace-pointer", nullptr,
 		"trace pointer position and print to stdout", oh_trace_pointer},
 	{0, "no-rand-sleep", nullptr,
 		"disable random sleep time difference", oh_no_rand_sleep},
+	{0, "real-time", nullptr,
+		"sleep for real with the test, null and count desktops "
+		"instead of advancing a simulated clock", oh_real_time},
+	{0, "poll-interval", "MS",
+		"milliseconds between screen checks while waiting for colors (default: 20)",
+		oh_poll_interval},
+	{0, "pace", "MIN[,MAX]",
+		"milliseconds to pause after events (default: 50); with MAX, adapted "
+		"between MIN and MAX to how fast the desktop handles them", oh_pace},
 	{'s', "no-ignore-space", nullptr,
 		"recognize spaces (0x09, 0x0a, 0x0d, 0x20) as keys in script", oh_no_ignore_space},
+	{'w', "window", "WINDOW",
+		"send keys to the window (ID, class:NAME or title:TEXT)", oh_window},
+#if VINPUT_DESKTOP_LINUX
+	{0, "screen-size", "WxH",
+		"screen size, for precise pointer movements with uinput; "
+		"required for \\? to report the position", oh_screen_size},
+	{0, "uinput-composite", nullptr,
+		"use one uinput device instead of a keyboard and a mouse", oh_uinput_composite},
+	{0, "uinput-io-uring", nullptr,
+		"submit uinput events through io_uring if available", oh_uinput_io_uring},
+	{0, "load", "DEVICES",
+		"generate load: type on DEVICES uinput devices and report the rates", oh_load},
+	{0, "load-threads", "N", "load worker threads (default: one per core)", oh_load_threads},
+	{0, "load-rate", "EVENTS", "target events per second of load (default: unlimited)", oh_load_rate},
+	{0, "load-time", "SEC", "seconds to generate load (default: 10)", oh_load_time},
+#endif // VINPUT_DESKTOP_LINUX
+#if VINPUT_DESKTOP_X11 || VINPUT_DESKTOP_XCB
+	{'d', "display", "NAME",
+		"X display to play on; repeat to play on several at once", oh_display},
+#endif // VINPUT_DESKTOP_X11 || VINPUT_DESKTOP_XCB
+#if VINPUT_DESKTOP_X11
+	{0, "x11-xtest-keys", nullptr,
+		"send keys with XTest instead of to the focused window", oh_x11_xtest_keys},
+#endif // VINPUT_DESKTOP_X11
+#ifndef _WIN32
+	{0, "daemon", nullptr,
+		"keep the desktop connected and play scripts submitted by clients", oh_daemon},
+	{0, "client", nullptr,
+		"compile the script and submit it to the daemon", oh_client},
+	{0, "socket", "PATH", "path of the daemon socket", oh_socket},
+#endif // !_WIN32
 	{0, nullptr, "FILE", nullptr, oh_file},
 	{0, nullptr, nullptr, nullptr, nullptr},
 };
@@ -130,19 +448,80 @@ static void print_program_help() noexcept {
 	argparse_help(&program);
 }
 
+static void connect_desktops(
+		const ArgParseContext &ctx, std::vector<Desktop *> &desktops) {
+	const auto count = std::max(ctx.displays.size(), std::size_t(1));
+	// With several displays, each test desktop writes to its own file,
+	// PATH.1, PATH.2, ..., instead of truncating the same one.
+	const auto test_path = test_desktop_options.path;
+	const bool test_paths = count > 1 && !test_path.empty() && test_path != "-";
+	for (std::size_t i = 0; i < count; i++) {
+		if (ctx.test) {
+			if (test_paths)
+				test_desktop_options.path = test_path + '.' + std::to_string(i + 1);
+			desktops.push_back(connect_test_desktop());
+			test_desktop_options.path = test_path;
+			continue;
+		}
+#if VINPUT_DESKTOP_XCB
+		if (ctx.desktop_name && !std::strcmp(ctx.desktop_name, "xcb")) {
+			desktops.push_back(
+				connect_xcb_desktop(ctx.displays.empty() ? nullptr : ctx.displays[i]));
+			continue;
+		}
+#endif // VINPUT_DESKTOP_XCB
+		if (ctx.desktop_name) {
+			desktops.push_back(connect_named_desktop(ctx.desktop_name));
+			continue;
+		}
+#if VINPUT_DESKTOP_X11
+		if (!ctx.displays.empty()) {
+			desktops.push_back(connect_x11_desktop(ctx.displays[i]));
+			continue;
+		}
+#endif // VINPUT_DESKTOP_X11
+		desktops.push_back(connect_current_desktop());
+	}
+	if (ctx.window) {
+		for (const auto desktop : desktops)
+			desktop->target(ctx.window);
+	}
+}
+
 static void parse_args(
-		int argc, char *argv[], Desktop *&desktop, Script &script) {
-	desktop = nullptr;
+		int argc, char *argv[],
+		RunMode &mode, std::string &socket_path,
+		std::vector<Desktop *> &desktops, Script &script) {
 	ArgParseContext ctx = {
-		.desktop = desktop,
+		.mode = mode,
+		.socket_path = socket_path,
 		.script = script,
+		.test = false,
+		.desktop_name = nullptr,
+		.window = nullptr,
+		.displays = { },
 	};
 	const auto ap_status = argparse_parse(options, argc, argv, &ctx);
 	if (!ap_status) {
-		if (!desktop)
-			desktop = connect_current_desktop();
-		if (script.empty())
+#ifndef _WIN32
+		if (mode != RunMode::PLAY && socket_path.empty())
+			socket_path = daemon_socket_path();
+#endif // !_WIN32
+		if (mode == RunMode::LOAD) {
+			if (!script.empty())
+				print_warning("script ignored in load mode");
+			return;
+		}
+		if (mode != RunMode::CLIENT)
+			connect_desktops(ctx, desktops);
+		else if (ctx.window)
+			print_warning("window ignored in client mode");
+		if (mode == RunMode::DAEMON) {
+			if (!script.empty())
+				print_warning("script ignored in daemon mode");
+		} else if (script.empty()) {
 			script.append(std::cin);
+		}
 		return;
 	}
 
@@ -1,21 +1,31 @@
 #include "script.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <chrono>
 #include <cctype>
 #include <cmath>
 #include <csignal>
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <fstream>
 #include <istream>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <ostream>
 #include <random>
+#include <string>
 #include <string_view>
 #include <thread>
 #include <utility>
 #include <vector>
 
 #include "desktop.h"
+#include "image_search.h"
 #include "prints.h"
 
 using namespace vinput;
@@ -34,6 +44,10 @@ struct Script::Impl {
 		POINTER_WHERE,
 		LOOP_BEGIN,
 		LOOP_END,
+		SCROLL,
+		TARGET,
+		WAIT,
+		FIND,
 		_COUNT
 	};
 
@@ -43,16 +57,52 @@ struct Script::Impl {
 		Instruction &operator=(std::pair<Opcode, unsigned int> x) noexcept;
 		Opcode opcode() const noexcept;
 		unsigned int operand() const noexcept;
+		std::uint16_t raw() const noexcept { return data; }
 
 	private:
 		std::uint16_t data;
 	};
 
+	struct ScrollMotion {
+		int dx, dy;
+		unsigned int duration_ms;
+	};
+
+	// Operand of WAIT for waiting until the desktop has handled the events.
+	static constexpr unsigned int WAIT_SYNC = 4095;
+
+	// Wait until all pixels of the area have the color.
+	struct ScreenWait {
+		Desktop::ScreenArea area;
+		std::uint32_t color; // 0x00RRGGBB
+		unsigned int tolerance; // Of each channel.
+		unsigned int timeout_ms;
+	};
+
+	// Find the image on the screen and move the pointer to its center.
+	struct ImageFind {
+		static constexpr std::uint32_t NO_BUTTON = 0xffffffff;
+
+		unsigned int image; // In `images`.
+		std::uint32_t button; // Clicked at the image, or NO_BUTTON.
+		unsigned int tolerance; // Of the average difference of channels.
+		unsigned int timeout_ms;
+	};
+
 	class Compiler;
 	class Player;
 
 	std::vector<Instruction> code;
 	std::vector<std::pair<unsigned int, unsigned int>> positions;
+	std::vector<ScrollMotion> scrolls;
+	std::vector<std::string> strings;
+	std::vector<ScreenWait> waits;
+	std::vector<Image> images;
+	std::vector<ImageFind> finds;
+
+	void save(std::ostream &out) const;
+	void load(std::istream &source);
+	bool verify() const noexcept;
 };
 
 class Script::Impl::Compiler {
@@ -63,6 +113,7 @@ public:
 private:
 	std::string string_buffer;
 	std::vector<const char *> strarr_buffer;
+	std::map<std::string, unsigned int, std::less<>> image_indices; // By path.
 
 	bool next_instr(std::istream &source, Script::Impl &script);
 	void parse_command(std::istream &source, Script::Impl &script);
@@ -71,9 +122,11 @@ private:
 	void command_enter(const std::vector<const char *> &args, Script::Impl &script);
 	void command_tab(const std::vector<const char *> &args, Script::Impl &script);
 	void command_space(const std::vector<const char *> &args, Script::Impl &script);
+	void command_sync(const std::vector<const char *> &args, Script::Impl &script);
 	void command_sleep(const std::vector<const char *> &args, Script::Impl &script);
 	void command_click_left(const std::vector<const char *> &args, Script::Impl &script);
 	void command_click_middle(const std::vector<const char *> &args, Script::Impl &script);
+	void command_scroll(const std::vector<const char *> &args, Script::Impl &script);
 	void command_click_right(const std::vector<const char *> &args, Script::Impl &script);
 	void command_move_pointer(const std::vector<const char *> &args, Script::Impl &script);
 	void command_find_pointer(const std::vector<const char *> &args, Script::Impl &script);
@@ -81,6 +134,9 @@ private:
 	void command_end_loop(const std::vector<const char *> &args, Script::Impl &script);
 	void command_send_key(const std::vector<const char *> &args, Script::Impl &script);
 	void command_send_button(const std::vector<const char *> &args, Script::Impl &script);
+	void command_target(const std::vector<const char *> &args, Script::Impl &script);
+	void command_wait(const std::vector<const char *> &args, Script::Impl &script);
+	void command_find(const std::vector<const char *> &args, Script::Impl &script);
 };
 
 class Script::Impl::Player {
@@ -94,7 +150,9 @@ public:
 
 	void random_sleep(bool status) noexcept;
 
-	void operator()(const Script::Impl &script, Desktop &desktop);
+	// Play until the end, SIGINT, or `*stop` (if not null) is set.
+	void operator()(
+		const Script::Impl &script, Desktop &desktop, const std::atomic_bool *stop = nullptr);
 
 private:
 	class StopToken {
@@ -104,7 +162,21 @@ private:
 		bool test() const noexcept { return state; }
 
 	private:
-		bool state = false;
+		std::atomic_bool state = false;
+	};
+
+	// Installs the SIGINT handler while any player is running.
+	class StopScope {
+	public:
+		StopScope() noexcept;
+		StopScope(const StopScope &) = delete;
+		~StopScope();
+		StopScope &operator=(const StopScope &) = delete;
+
+	private:
+		static std::mutex mutex;
+		static unsigned int count;
+		static bool installed;
 	};
 
 	struct Random {
@@ -120,9 +192,33 @@ private:
 	static StopToken stop_token;
 
 	Random *random;
+	Desktop *simulated_clock; // Desktop to pass the time to instead of sleeping.
+	const std::atomic_bool *stop_request; // Of this play only. May be null.
 	std::vector<LoopBlock> loops;
-
+	std::vector<std::uint32_t> pixels; // Captured by poll_screen().
+	std::vector<std::unique_ptr<ImageSearch>> searches; // By image, made when needed.
+	std::uint64_t round_trip_us; // Of syncs, smoothed. 0 before the first one.
+
+	// Longest sleep without checking whether to stop.
+	static constexpr unsigned int STOP_CHECK_MS = 100;
+	static constexpr unsigned int SCROLL_STEP_MS = 16;
+	static constexpr unsigned int SCROLL_MAX_STEPS = 16;
+	// Pauses are this many times the round trip, to leave the desktop time
+	// for the events and anything they cause.
+	static constexpr unsigned int PACE_ROUND_TRIPS = 8;
+	// Seed of sleep time differences on simulated clocks, for repeatable runs.
+	static constexpr std::mt19937::result_type SIMULATED_TIME_SEED = 20240401;
+
+	bool stopped() const noexcept;
 	void sleep_ms(unsigned int time_ms) noexcept;
+	void pace(Desktop &desktop);
+	void sync(Desktop &desktop);
+	void scroll(Desktop &desktop, const ScrollMotion &motion);
+	void wait(Desktop &desktop, const ScreenWait &wait);
+	bool find(Desktop &desktop, const Script::Impl &script, const ImageFind &find);
+	template <typename Func> bool poll_screen(
+		Desktop &desktop, Desktop::ScreenArea area, unsigned int timeout_ms,
+		const char *timeout_message, Func &&done);
 	void print_pointer(const Desktop &desktop, unsigned int flags) noexcept;
 };
 
@@ -147,6 +243,226 @@ unsigned int Script::Impl::Instruction::operand() const noexcept {
 	return static_cast<unsigned int>(this->data >> 4);
 }
 
+static constexpr char bytecode_magic[8] = {'V', 'I', 'N', 'P', 'U', 'T', 'B', 'C'};
+static constexpr std::uint32_t bytecode_version = 6;
+static constexpr std::uint32_t string_size_limit = 4096;
+static constexpr std::uint32_t screen_size_limit = 16384; // Of areas, in pixels.
+static constexpr std::size_t image_pixels_limit = std::size_t(1) << 24;
+
+template <typename T> static void _write_raw(std::ostream &out, T value) {
+	out.write(reinterpret_cast<const char *>(&value), sizeof value);
+}
+
+template <typename T> static T _read_raw(std::istream &source) {
+	T value;
+	if (!source.read(reinterpret_cast<char *>(&value), sizeof value))
+		throw ScriptSyntaxError(ScriptSyntaxError::BAD_BYTECODE);
+	return value;
+}
+
+void Script::Impl::save(std::ostream &out) const {
+	out.write(bytecode_magic, sizeof bytecode_magic);
+	_write_raw<std::uint32_t>(out, bytecode_version);
+	_write_raw<std::uint32_t>(out, std::uint32_t(this->code.size()));
+	_write_raw<std::uint32_t>(out, std::uint32_t(this->positions.size()));
+	_write_raw<std::uint32_t>(out, std::uint32_t(this->scrolls.size()));
+	_write_raw<std::uint32_t>(out, std::uint32_t(this->strings.size()));
+	_write_raw<std::uint32_t>(out, std::uint32_t(this->waits.size()));
+	_write_raw<std::uint32_t>(out, std::uint32_t(this->images.size()));
+	_write_raw<std::uint32_t>(out, std::uint32_t(this->finds.size()));
+	for (const auto instr : this->code)
+		_write_raw<std::uint16_t>(out, instr.raw());
+	for (const auto &[x, y] : this->positions) {
+		_write_raw<std::uint32_t>(out, x);
+		_write_raw<std::uint32_t>(out, y);
+	}
+	for (const auto &motion : this->scrolls) {
+		_write_raw<std::int32_t>(out, motion.dx);
+		_write_raw<std::int32_t>(out, motion.dy);
+		_write_raw<std::uint32_t>(out, motion.duration_ms);
+	}
+	for (const auto &str : this->strings) {
+		_write_raw<std::uint32_t>(out, std::uint32_t(str.size()));
+		out.write(str.data(), std::streamsize(str.size()));
+	}
+	for (const auto &wait : this->waits) {
+		_write_raw<std::uint32_t>(out, wait.area.x);
+		_write_raw<std::uint32_t>(out, wait.area.y);
+		_write_raw<std::uint32_t>(out, wait.area.width);
+		_write_raw<std::uint32_t>(out, wait.area.height);
+		_write_raw<std::uint32_t>(out, wait.color);
+		_write_raw<std::uint32_t>(out, wait.tolerance);
+		_write_raw<std::uint32_t>(out, wait.timeout_ms);
+	}
+	for (const auto &image : this->images) {
+		_write_raw<std::uint32_t>(out, image.width);
+		_write_raw<std::uint32_t>(out, image.height);
+		out.write(
+			reinterpret_cast<const char *>(image.pixels.data()),
+			std::streamsize(image.pixels.size() * sizeof image.pixels[0]));
+	}
+	for (const auto &find : this->finds) {
+		_write_raw<std::uint32_t>(out, find.image);
+		_write_raw<std::uint32_t>(out, find.button);
+		_write_raw<std::uint32_t>(out, find.tolerance);
+		_write_raw<std::uint32_t>(out, find.timeout_ms);
+	}
+}
+
+void Script::Impl::load(std::istream &source) {
+	char magic[sizeof bytecode_magic];
+	if (!source.read(magic, sizeof magic) ||
+			std::memcmp(magic, bytecode_magic, sizeof magic) ||
+			_read_raw<std::uint32_t>(source) != bytecode_version)
+		throw ScriptSyntaxError(ScriptSyntaxError::BAD_BYTECODE);
+	const auto code_size = _read_raw<std::uint32_t>(source);
+	const auto positions_size = _read_raw<std::uint32_t>(source);
+	const auto scrolls_size = _read_raw<std::uint32_t>(source);
+	const auto strings_size = _read_raw<std::uint32_t>(source);
+	const auto waits_size = _read_raw<std::uint32_t>(source);
+	const auto images_size = _read_raw<std::uint32_t>(source);
+	const auto finds_size = _read_raw<std::uint32_t>(source);
+
+	this->code.clear();
+	this->positions.clear();
+	this->scrolls.clear();
+	this->strings.clear();
+	this->waits.clear();
+	this->images.clear();
+	this->finds.clear();
+	for (std::uint32_t i = 0; i < code_size; i++) {
+		const auto data = _read_raw<std::uint16_t>(source);
+		this->code.emplace_back(static_cast<Opcode>(data & 0b1111), data >> 4);
+	}
+	for (std::uint32_t i = 0; i < positions_size; i++) {
+		const auto x = _read_raw<std::uint32_t>(source);
+		const auto y = _read_raw<std::uint32_t>(source);
+		this->positions.emplace_back(x, y);
+	}
+	for (std::uint32_t i = 0; i < scrolls_size; i++) {
+		const auto dx = _read_raw<std::int32_t>(source);
+		const auto dy = _read_raw<std::int32_t>(source);
+		const auto duration_ms = _read_raw<std::uint32_t>(source);
+		this->scrolls.push_back({dx, dy, duration_ms});
+	}
+	for (std::uint32_t i = 0; i < strings_size; i++) {
+		const auto size = _read_raw<std::uint32_t>(source);
+		if (size > string_size_limit)
+			throw ScriptSyntaxError(ScriptSyntaxError::BAD_BYTECODE);
+		auto &str = this->strings.emplace_back(size, '\0');
+		if (!source.read(str.data(), std::streamsize(size)))
+			throw ScriptSyntaxError(ScriptSyntaxError::BAD_BYTECODE);
+	}
+	for (std::uint32_t i = 0; i < waits_size; i++) {
+		ScreenWait wait;
+		wait.area.x = _read_raw<std::uint32_t>(source);
+		wait.area.y = _read_raw<std::uint32_t>(source);
+		wait.area.width = _read_raw<std::uint32_t>(source);
+		wait.area.height = _read_raw<std::uint32_t>(source);
+		wait.color = _read_raw<std::uint32_t>(source);
+		wait.tolerance = _read_raw<std::uint32_t>(source);
+		wait.timeout_ms = _read_raw<std::uint32_t>(source);
+		this->waits.push_back(wait);
+	}
+	for (std::uint32_t i = 0; i < images_size; i++) {
+		auto &image = this->images.emplace_back();
+		image.width = _read_raw<std::uint32_t>(source);
+		image.height = _read_raw<std::uint32_t>(source);
+		if (!image.width || !image.height || image.width > image_pixels_limit / image.height)
+			throw ScriptSyntaxError(ScriptSyntaxError::BAD_BYTECODE);
+		image.pixels.resize(std::size_t(image.width) * image.height);
+		if (!source.read(
+				reinterpret_cast<char *>(image.pixels.data()),
+				std::streamsize(image.pixels.size() * sizeof image.pixels[0])))
+			throw ScriptSyntaxError(ScriptSyntaxError::BAD_BYTECODE);
+	}
+	for (std::uint32_t i = 0; i < finds_size; i++) {
+		ImageFind find;
+		find.image = _read_raw<std::uint32_t>(source);
+		find.button = _read_raw<std::uint32_t>(source);
+		find.tolerance = _read_raw<std::uint32_t>(source);
+		find.timeout_ms = _read_raw<std::uint32_t>(source);
+		this->finds.push_back(find);
+	}
+
+	if (!this->verify()) {
+		this->code.clear();
+		this->positions.clear();
+		this->scrolls.clear();
+		this->strings.clear();
+		this->waits.clear();
+		this->images.clear();
+		this->finds.clear();
+		throw ScriptSyntaxError(ScriptSyntaxError::BAD_BYTECODE);
+	}
+}
+
+bool Script::Impl::verify() const noexcept {
+	for (const auto instr : this->code) {
+		const auto operand = instr.operand();
+		switch (instr.opcode()) {
+			using enum Impl::Opcode;
+
+		case KEY_UP:
+		case KEY_DOWN:
+		case KEY_CLICK:
+			if (operand >= std::size_t(Desktop::Key::_COUNT))
+				return false;
+			break;
+
+		case BUTTON_UP:
+		case BUTTON_DOWN:
+		case BUTTON_CLICK:
+			if (operand >= std::size_t(Desktop::Button::_COUNT))
+				return false;
+			break;
+
+		case POINTER_GOTO:
+			if (operand >= this->positions.size())
+				return false;
+			break;
+
+		case SCROLL:
+			if (operand >= this->scrolls.size())
+				return false;
+			break;
+
+		case TARGET:
+			if (operand >= this->strings.size())
+				return false;
+			break;
+
+		case WAIT:
+			if (operand == WAIT_SYNC)
+				break;
+			if (operand >= this->waits.size())
+				return false;
+			if (const auto &wait = this->waits[operand];
+					!wait.area.width || wait.area.width > screen_size_limit ||
+					!wait.area.height || wait.area.height > screen_size_limit ||
+					wait.color > 0xffffff || wait.tolerance > 0xff)
+				return false;
+			break;
+
+		case FIND:
+			if (operand >= this->finds.size())
+				return false;
+			if (const auto &find = this->finds[operand];
+					find.image >= this->images.size() || find.tolerance > 0xff ||
+					(find.button != ImageFind::NO_BUTTON &&
+						find.button >= std::size_t(Desktop::Button::_COUNT)))
+				return false;
+			break;
+
+		default:
+			if (instr.opcode() >= Opcode::_COUNT)
+				return false;
+			break;
+		}
+	}
+	return true;
+}
+
 static void _print_doc_cell(
 		std::size_t index, std::string_view str, char quote,
 		std::ostream &out) noexcept {
@@ -195,6 +511,8 @@ command
 	| "\#" | ("\[#" FLOAT "]")  (* sleep for 1 or FLOAT seconds *)
 	| "\<"  (* left click *)
 	| "\|" | "\[|^]" | "\[|v]"  (* middle click / scroll up / scroll down *)
+	| "\[|" ("^" | "v" | "<" | ">") "," FLOAT [ "," FLOAT ] "]"
+		(* scroll FLOAT notches up / down / left / right [in FLOAT seconds] *)
 	| "\>"  (* right click *)
 	| "\[@" INT "," INT "]"  (* move pointer to the coordinate *)
 	| "\?" | "\[?!]"  (* get pointer coordinate and print / print without LF *)
@@ -202,6 +520,16 @@ command
 	| "\}"  (* end loop *)
 	| "\[$" KEY_NAME [ "," "v" | "^" ] "]"  (* click / press / release key *)
 	| "\[%" BUTTON_NAME [ "," "v" | "^" ] "]"  (* click / press / release button *)
+	| "\[=" [ WINDOW ] "]"  (* send keys to the window / the focused window *)
+	| "\[sync]"  (* wait until the desktop has handled the events *)
+	| "\[~" INT "," INT [ "," INT "x" INT ] "," COLOR [ "," FLOAT [ "," INT ] ] "]"
+		(* wait until the pixel / the INTxINT area at the coordinate has color
+		   COLOR (RRGGBB), each channel within INT (default: 0), or fail after
+		   FLOAT seconds (default: 10) *)
+	| "\[*" FILE [ "," ( "<" | "|" | ">" ) ] [ "," FLOAT [ "," INT ] ] "]"
+		(* find the image in the PPM file (P6) on the screen, move the pointer
+		   to its center [and click], or fail after FLOAT seconds (default: 10);
+		   channels may differ by INT on average (default: 8) *)
 	;
 )%%"sv;
 	out.write(doc.data(), doc.length());
@@ -359,7 +687,29 @@ void Script::Impl::Compiler::parse_command(
 	using command_func_t =
 		void (Compiler::*)(const std::vector<const char *> &, Script::Impl &);
 	command_func_t command_func;
-	switch (command) {
+
+	// Named by a word in brackets, like "\[sync]", arguments following a comma.
+	bool word_command = false;
+	if (has_args && std::isalpha(static_cast<unsigned char>(command))) {
+		static constexpr std::pair<std::string_view, command_func_t> word_commands[] = {
+			{"sync", &Compiler::command_sync},
+		};
+		auto &name = this->string_buffer;
+		name.assign(1, command);
+		while (std::isalpha(source.peek()))
+			name.push_back(char(source.get()));
+		const auto iter = std::find_if(
+			std::begin(word_commands), std::end(word_commands),
+			[&name](const auto &entry) { return entry.first == name; });
+		if (iter == std::end(word_commands))
+			throw ScriptSyntaxError(ScriptSyntaxError::UNKNOWN_COMMAND);
+		command_func = iter->second;
+		word_command = true;
+		if (source.peek() == ',')
+			source.get();
+		else if (source.peek() != ']')
+			throw ScriptSyntaxError(ScriptSyntaxError::UNKNOWN_COMMAND);
+	} else switch (command) {
 	case '\\':command_func = &Compiler::command_backslash; break;
 	case 'n': case 'r': command_func = &Compiler::command_enter; break;
 	case 't': command_func = &Compiler::command_tab; break;
@@ -374,6 +724,9 @@ void Script::Impl::Compiler::parse_command(
 	case '}': command_func = &Compiler::command_end_loop; break;
 	case '$': command_func = &Compiler::command_send_key; break;
 	case '%': command_func = &Compiler::command_send_button; break;
+	case '=': command_func = &Compiler::command_target; break;
+	case '~': command_func = &Compiler::command_wait; break;
+	case '*': command_func = &Compiler::command_find; break;
 	default: throw ScriptSyntaxError(ScriptSyntaxError::UNKNOWN_COMMAND);
 	}
 
@@ -382,7 +735,8 @@ void Script::Impl::Compiler::parse_command(
 	if (has_args) {
 		auto &argstr = this->string_buffer;
 		std::getline(source, argstr, ']');
-		for (std::size_t off = 0; ; ) {
+		// Word commands may have no arguments.
+		for (std::size_t off = 0; !word_command || !argstr.empty(); ) {
 			const auto pos = argstr.find(',', off);
 			args.emplace_back(argstr.c_str() + off);
 			if (pos == argstr.npos)
@@ -423,6 +777,13 @@ void Script::Impl::Compiler::command_space(
 	script.code.emplace_back(Opcode::KEY_CLICK, unsigned(Desktop::Key::SPACE));
 }
 
+void Script::Impl::Compiler::command_sync(
+		const std::vector<const char *> &args, Script::Impl &script) {
+	if (!args.empty())
+		throw ScriptSyntaxError(ScriptSyntaxError::ILLEGAL_ARGUMENT);
+	script.code.emplace_back(Opcode::WAIT, WAIT_SYNC);
+}
+
 void Script::Impl::Compiler::command_sleep(
 		const std::vector<const char *> &args, Script::Impl &script) {
 	if (args.empty()) {
@@ -470,14 +831,49 @@ void Script::Impl::Compiler::command_click_middle(
 			button = Desktop::Button::SCROLL_UP;
 		else if (dir == 'v' || dir == 'V' )
 			button = Desktop::Button::SCROLL_DOWN;
+		else if (dir == '<' || dir == '>')
+			return this->command_scroll(args, script);
 		else
 			throw ScriptSyntaxError(ScriptSyntaxError::ILLEGAL_ARGUMENT);
+	} else if (args.size() <= 3) {
+		return this->command_scroll(args, script);
 	} else {
 		throw ScriptSyntaxError(ScriptSyntaxError::ILLEGAL_ARGUMENT);
 	}
 	script.code.emplace_back(Opcode::BUTTON_CLICK, unsigned(button));
 }
 
+void Script::Impl::Compiler::command_scroll(
+		const std::vector<const char *> &args, Script::Impl &script) {
+	if (args.empty() || args.size() > 3 || !args[0][0] || args[0][1])
+		throw ScriptSyntaxError(ScriptSyntaxError::ILLEGAL_ARGUMENT);
+	int dx = 0, dy = 0;
+	switch (args[0][0]) {
+	case '^': dy = 1; break;
+	case 'v': case 'V': dy = -1; break;
+	case '<': dx = -1; break;
+	case '>': dx = 1; break;
+	default: throw ScriptSyntaxError(ScriptSyntaxError::ILLEGAL_ARGUMENT);
+	}
+	const auto amount = args.size() >= 2 ? std::atof(args[1]) : 1.0;
+	const auto duration = args.size() >= 3 ? std::atof(args[2]) : 0.0;
+	if (!(amount > 0 && amount <= 1e6) || !(duration >= 0 && duration <= 4096))
+		throw ScriptSyntaxError(ScriptSyntaxError::ILLEGAL_ARGUMENT);
+	const auto distance = static_cast<int>(std::lround(amount * Desktop::SCROLL_NOTCH));
+	const ScrollMotion scroll{dx * distance, dy * distance, unsigned(duration * 1e3)};
+	const auto iter = std::find_if(
+		script.scrolls.begin(), script.scrolls.end(), [&scroll](const ScrollMotion &s) {
+			return s.dx == scroll.dx && s.dy == scroll.dy && s.duration_ms == scroll.duration_ms;
+		});
+	const auto index = std::size_t(iter - script.scrolls.begin());
+	if (iter == script.scrolls.end()) {
+		if (index >= 4096) // Not fitting in the operand.
+			throw ScriptSyntaxError(ScriptSyntaxError::ILLEGAL_ARGUMENT);
+		script.scrolls.push_back(scroll);
+	}
+	script.code.emplace_back(Opcode::SCROLL, unsigned(index));
+}
+
 void Script::Impl::Compiler::command_click_right(
 		const std::vector<const char *> &args, Script::Impl &script) {
 	if (!args.empty())
@@ -574,9 +970,145 @@ void Script::Impl::Compiler::command_send_button(
 	script.code.emplace_back(op, static_cast<unsigned int>(button));
 }
 
+void Script::Impl::Compiler::command_target(
+		const std::vector<const char *> &args, Script::Impl &script) {
+	// The window title may contain commas.
+	std::string spec;
+	for (std::size_t i = 0; i < args.size(); i++) {
+		if (i)
+			spec += ',';
+		spec += args[i];
+	}
+	const auto iter = std::find(script.strings.begin(), script.strings.end(), spec);
+	const auto index = std::size_t(iter - script.strings.begin());
+	if (iter == script.strings.end()) {
+		if (index >= 4096) // Not fitting in the operand.
+			throw ScriptSyntaxError(ScriptSyntaxError::ILLEGAL_ARGUMENT);
+		script.strings.push_back(std::move(spec));
+	}
+	script.code.emplace_back(Opcode::TARGET, unsigned(index));
+}
+
+void Script::Impl::Compiler::command_wait(
+		const std::vector<const char *> &args, Script::Impl &script) {
+	if (args.size() < 3 || args.size() > 6)
+		throw ScriptSyntaxError(ScriptSyntaxError::ILLEGAL_ARGUMENT);
+	ScreenWait wait;
+	char end;
+	if (std::sscanf(args[0], "%u%c", &wait.area.x, &end) != 1 ||
+			std::sscanf(args[1], "%u%c", &wait.area.y, &end) != 1)
+		throw ScriptSyntaxError(ScriptSyntaxError::ILLEGAL_ARGUMENT);
+	std::size_t i = 2;
+	if (std::strchr(args[i], 'x')) {
+		if (std::sscanf(args[i], "%ux%u%c", &wait.area.width, &wait.area.height, &end) != 2 ||
+				!wait.area.width || wait.area.width > screen_size_limit ||
+				!wait.area.height || wait.area.height > screen_size_limit)
+			throw ScriptSyntaxError(ScriptSyntaxError::ILLEGAL_ARGUMENT);
+		i++;
+	} else {
+		wait.area.width = 1;
+		wait.area.height = 1;
+	}
+	if (i >= args.size())
+		throw ScriptSyntaxError(ScriptSyntaxError::ILLEGAL_ARGUMENT);
+	const char *const color = args[i][0] == '#' ? args[i] + 1 : args[i];
+	if (std::strlen(color) != 6 || std::strspn(color, "0123456789abcdefABCDEF") != 6)
+		throw ScriptSyntaxError(ScriptSyntaxError::ILLEGAL_ARGUMENT);
+	wait.color = std::uint32_t(std::strtoul(color, nullptr, 16));
+	i++;
+	const auto timeout = i < args.size() ? std::atof(args[i]) : 10.0;
+	if (!(timeout >= 0 && timeout <= 1e6))
+		throw ScriptSyntaxError(ScriptSyntaxError::ILLEGAL_ARGUMENT);
+	wait.timeout_ms = unsigned(timeout * 1e3);
+	i++;
+	wait.tolerance = 0;
+	if (i < args.size() &&
+			(std::sscanf(args[i], "%u%c", &wait.tolerance, &end) != 1 || wait.tolerance > 0xff))
+		throw ScriptSyntaxError(ScriptSyntaxError::ILLEGAL_ARGUMENT);
+	if (i + 1 < args.size())
+		throw ScriptSyntaxError(ScriptSyntaxError::ILLEGAL_ARGUMENT);
+
+	const auto index = script.waits.size();
+	if (index >= WAIT_SYNC) // Not fitting in the operand.
+		throw ScriptSyntaxError(ScriptSyntaxError::ILLEGAL_ARGUMENT);
+	script.waits.push_back(wait);
+	script.code.emplace_back(Opcode::WAIT, unsigned(index));
+}
+
+void Script::Impl::Compiler::command_find(
+		const std::vector<const char *> &args, Script::Impl &script) {
+	if (args.empty() || args.size() > 4 || !args[0][0])
+		throw ScriptSyntaxError(ScriptSyntaxError::ILLEGAL_ARGUMENT);
+	ImageFind find;
+
+	// Images used again are not read again.
+	if (const auto iter = this->image_indices.find(std::string_view(args[0]));
+			iter != this->image_indices.end()) {
+		find.image = iter->second;
+	} else {
+		std::ifstream file(args[0], std::ios::binary);
+		Image image;
+		if (!file.is_open() || !read_ppm_image(file, image))
+			throw ScriptSyntaxError(ScriptSyntaxError::ILLEGAL_ARGUMENT);
+		find.image = unsigned(script.images.size());
+		script.images.push_back(std::move(image));
+		this->image_indices.emplace(args[0], find.image);
+	}
+
+	std::size_t i = 1;
+	find.button = ImageFind::NO_BUTTON;
+	if (i < args.size() && args[i][0] && !args[i][1]) {
+		switch (args[i][0]) {
+		case '<': find.button = std::uint32_t(Desktop::Button::LEFT); i++; break;
+		case '|': find.button = std::uint32_t(Desktop::Button::MIDDLE); i++; break;
+		case '>': find.button = std::uint32_t(Desktop::Button::RIGHT); i++; break;
+		default: break;
+		}
+	}
+	const auto timeout = i < args.size() ? std::atof(args[i]) : 10.0;
+	if (!(timeout >= 0 && timeout <= 1e6))
+		throw ScriptSyntaxError(ScriptSyntaxError::ILLEGAL_ARGUMENT);
+	find.timeout_ms = unsigned(timeout * 1e3);
+	i++;
+	find.tolerance = 8;
+	char end;
+	if (i < args.size() &&
+			(std::sscanf(args[i], "%u%c", &find.tolerance, &end) != 1 || find.tolerance > 0xff))
+		throw ScriptSyntaxError(ScriptSyntaxError::ILLEGAL_ARGUMENT);
+	if (i + 1 < args.size())
+		throw ScriptSyntaxError(ScriptSyntaxError::ILLEGAL_ARGUMENT);
+
+	const auto index = script.finds.size();
+	if (index >= 4096) // Not fitting in the operand.
+		throw ScriptSyntaxError(ScriptSyntaxError::ILLEGAL_ARGUMENT);
+	script.finds.push_back(find);
+	script.code.emplace_back(Opcode::FIND, unsigned(index));
+}
+
 Script::Impl::Player::StopToken Script::Impl::Player::stop_token;
+std::mutex Script::Impl::Player::StopScope::mutex;
+unsigned int Script::Impl::Player::StopScope::count = 0;
+bool Script::Impl::Player::StopScope::installed = false;
+
+Script::Impl::Player::StopScope::StopScope() noexcept {
+	std::lock_guard lock(StopScope::mutex);
+	if (StopScope::count++)
+		return;
+	Player::stop_token.clear();
+	StopScope::installed = Script::catch_interrupt;
+	if (StopScope::installed)
+		std::signal(SIGINT, [](int) { Player::stop_token.set(); });
+}
+
+Script::Impl::Player::StopScope::~StopScope() {
+	std::lock_guard lock(StopScope::mutex);
+	if (--StopScope::count || !StopScope::installed)
+		return;
+	std::signal(SIGINT, SIG_DFL);
+}
 
-Script::Impl::Player::Player() noexcept : random(nullptr) {
+Script::Impl::Player::Player() noexcept :
+		random(nullptr), simulated_clock(nullptr), stop_request(nullptr), round_trip_us(0) {
 }
 
 Script::Impl::Player::~Player () {
@@ -596,14 +1128,23 @@ void Script::Impl::Player::random_sleep(bool status) noexcept {
 	}
 }
 
-void Script::Impl::Player::operator()(const Script::Impl &script, Desktop &desktop) {
-	Player::stop_token.clear();
-	std::signal(SIGINT, [](int) { Player::stop_token.set(); });
+void Script::Impl::Player::operator()(
+		const Script::Impl &script, Desktop &desktop, const std::atomic_bool *stop) {
+	const StopScope stop_scope;
+	this->stop_request = stop;
 	this->loops.clear();
+	this->round_trip_us = 0;
+	this->searches.clear();
+	this->searches.resize(script.images.size());
+	this->simulated_clock = desktop.simulated_time() ? &desktop : nullptr;
+	if (this->simulated_clock && this->random) {
+		this->random->rand_gen.seed(Player::SIMULATED_TIME_SEED);
+		this->random->norm_dist.reset();
+	}
 
 	const auto *code_pointer = script.code.data();
 	const auto *const code_end = code_pointer + script.code.size();
-	while (code_pointer < code_end && !Player::stop_token.test()) {
+	while (code_pointer < code_end && !this->stopped()) {
 		const auto instruction = *code_pointer++;
 		const auto operand = instruction.operand();
 
@@ -679,6 +1220,26 @@ void Script::Impl::Player::operator()(const Script::Impl &script, Desktop &deskt
 			this->print_pointer(desktop, operand);
 			break;
 
+		case SCROLL:
+			this->scroll(desktop, script.scrolls[operand]);
+			break;
+
+		case TARGET:
+			desktop.target(script.strings[operand]);
+			continue;
+
+		case WAIT:
+			if (operand == WAIT_SYNC)
+				this->sync(desktop);
+			else
+				this->wait(desktop, script.waits[operand]);
+			continue;
+
+		case FIND:
+			if (!this->find(desktop, script, script.finds[operand]))
+				continue;
+			break;
+
 		case LOOP_BEGIN:
 			this->loops.emplace_back(code_pointer, operand);
 			break;
@@ -700,11 +1261,13 @@ void Script::Impl::Player::operator()(const Script::Impl &script, Desktop &deskt
 			continue;
 		}
 
-		desktop.flush();
-		this->sleep_ms(50);
+		this->pace(desktop);
 	}
+}
 
-	std::signal(SIGINT, SIG_DFL);
+bool Script::Impl::Player::stopped() const noexcept {
+	return Player::stop_token.test() ||
+		(this->stop_request && this->stop_request->load(std::memory_order_relaxed));
 }
 
 void Script::Impl::Player::sleep_ms(unsigned int time_ms) noexcept {
@@ -715,7 +1278,129 @@ void Script::Impl::Player::sleep_ms(unsigned int time_ms) noexcept {
 			off = 0;
 		time_ms += static_cast<int>(off);
 	}
-	std::this_thread::sleep_for(std::chrono::milliseconds(time_ms));
+	if (this->simulated_clock) {
+		this->simulated_clock->pass_time(time_ms);
+		return;
+	}
+	// Long sleeps in slices, to stop soon when asked to.
+	for (; time_ms > STOP_CHECK_MS && !this->stopped(); time_ms -= STOP_CHECK_MS)
+		std::this_thread::sleep_for(std::chrono::milliseconds(STOP_CHECK_MS));
+	if (!this->stopped())
+		std::this_thread::sleep_for(std::chrono::milliseconds(time_ms));
+}
+
+// Send the events, and pause for Script::pace_min_ms to Script::pace_max_ms,
+// longer while the desktop is slow to handle them.
+void Script::Impl::Player::pace(Desktop &desktop) {
+	if (Script::pace_min_ms >= Script::pace_max_ms) {
+		desktop.flush();
+		this->sleep_ms(Script::pace_max_ms);
+		return;
+	}
+	this->sync(desktop);
+	const auto pause_ms = (this->round_trip_us * PACE_ROUND_TRIPS + 999) / 1000;
+	this->sleep_ms(unsigned(std::clamp<std::uint64_t>(
+		pause_ms, Script::pace_min_ms, Script::pace_max_ms)));
+}
+
+// Wait until the desktop has handled the events, and measure how long it took.
+void Script::Impl::Player::sync(Desktop &desktop) {
+	using Clock = std::chrono::steady_clock;
+
+	// Simulated clocks get no real delays, which would make runs differ.
+	if (this->simulated_clock) {
+		desktop.sync();
+		return;
+	}
+	const auto start = Clock::now();
+	desktop.sync();
+	const auto time_us = std::uint64_t(
+		std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count());
+	this->round_trip_us = this->round_trip_us ? (this->round_trip_us * 7 + time_us) / 8 : time_us;
+}
+
+void Script::Impl::Player::scroll(Desktop &desktop, const ScrollMotion &motion) {
+	// Split the distance into a few steps spread over the duration.
+	const auto steps =
+		std::clamp(motion.duration_ms / SCROLL_STEP_MS, 1u, SCROLL_MAX_STEPS);
+	for (unsigned int i = 0; i < steps; i++) {
+		if (i) {
+			desktop.flush();
+			this->sleep_ms(motion.duration_ms / steps);
+		}
+		const auto part = [i, steps](int total) {
+			return static_cast<int>(
+				std::int64_t(total) * (i + 1) / steps - std::int64_t(total) * i / steps);
+		};
+		desktop.scroll(part(motion.dx), part(motion.dy));
+	}
+}
+
+// Capture the area until `done()` accepts `pixels`, or throw after the
+// timeout. Returns false if the desktop has no screen, or if stopped.
+template <typename Func> bool Script::Impl::Player::poll_screen(
+		Desktop &desktop, Desktop::ScreenArea area, unsigned int timeout_ms,
+		const char *timeout_message, Func &&done) {
+	using Clock = std::chrono::steady_clock;
+
+	this->pixels.resize(std::size_t(area.width) * area.height);
+	const auto deadline = Clock::now() + std::chrono::milliseconds(timeout_ms);
+	while (true) {
+		if (!desktop.capture(area, this->pixels.data()))
+			return false;
+		if (done())
+			return true;
+		if (Clock::now() >= deadline)
+			throw DesktopBaseError("vinput", timeout_message);
+		if (this->stopped())
+			return false;
+		// Not randomized; the screen is polled, not typed on.
+		std::this_thread::sleep_for(std::chrono::milliseconds(Script::poll_interval_ms));
+	}
+}
+
+void Script::Impl::Player::wait(Desktop &desktop, const ScreenWait &wait) {
+	const auto matches = [&wait](std::uint32_t pixel) {
+		for (int shift = 0; shift < 24; shift += 8) {
+			const auto a = (pixel >> shift) & 0xff, b = (wait.color >> shift) & 0xff;
+			if ((a > b ? a - b : b - a) > wait.tolerance)
+				return false;
+		}
+		return true;
+	};
+	this->poll_screen(
+		desktop, wait.area, wait.timeout_ms, "timed out waiting for the screen",
+		[this, &matches] { return std::all_of(this->pixels.begin(), this->pixels.end(), matches); });
+}
+
+// Returns whether events were sent.
+bool Script::Impl::Player::find(
+		Desktop &desktop, const Script::Impl &script, const ImageFind &find) {
+	const auto &image = script.images[find.image];
+	auto &search = this->searches[find.image];
+	if (!search)
+		search = std::make_unique<ImageSearch>(image);
+
+	const auto area = desktop.screen_area();
+	ImageSearch::Match match;
+	const auto found = this->poll_screen(
+		desktop, area, find.timeout_ms, "image not found on the screen",
+		[&] {
+			const auto [pos, ok] =
+				search->find(this->pixels.data(), area.width, area.height, find.tolerance);
+			match = pos;
+			return ok;
+		});
+	if (!found)
+		return false;
+
+	desktop.pointer({area.x + match.x + image.width / 2, area.y + match.y + image.height / 2});
+	if (find.button != ImageFind::NO_BUTTON) {
+		const auto button = static_cast<Desktop::Button>(find.button);
+		desktop.button(button, Desktop::PressAction::Press);
+		desktop.button(button, Desktop::PressAction::Release);
+	}
+	return true;
 }
 
 void Script::Impl::Player::print_pointer(
@@ -734,6 +1419,10 @@ void Script::Impl::Player::print_pointer(
 
 bool Script::random_sleep = true;
 bool Script::ignore_space = true;
+bool Script::catch_interrupt = true;
+unsigned int Script::poll_interval_ms = 20;
+unsigned int Script::pace_min_ms = 50;
+unsigned int Script::pace_max_ms = 50;
 
 Script::Script() noexcept : _impl(new Impl) {
 }
@@ -754,6 +1443,7 @@ Script::~Script() {
 Script &Script::operator=(Script &&other) noexcept {
 	this->~Script();
 	this->_impl = other._impl;
+	other._impl = nullptr;
 	return *this;
 }
 
@@ -774,12 +1464,25 @@ void Script::clear() noexcept {
 	auto &impl = *this->_impl;
 	impl.code.clear();
 	impl.positions.clear();
+	impl.scrolls.clear();
+	impl.strings.clear();
+	impl.waits.clear();
+	impl.images.clear();
+	impl.finds.clear();
+}
+
+void Script::save(std::ostream &out) const {
+	this->_impl->save(out);
+}
+
+void Script::load(std::istream &source) {
+	this->_impl->load(source);
 }
 
-void Script::play(Desktop &desktop) const {
+void Script::play(Desktop &desktop, const std::atomic_bool *stop) const {
 	Impl::Player player;
 	player.random_sleep(Script::random_sleep);
-	player(*this->_impl, desktop);
+	player(*this->_impl, desktop, stop);
 }
 
 const char *ScriptSyntaxError::what() const noexcept {
@@ -788,6 +1491,7 @@ const char *ScriptSyntaxError::what() const noexcept {
 	case UNKNOWN_KEY: s = "unknown key"; break;
 	case UNKNOWN_COMMAND: s = "unknown command"; break;
 	case ILLEGAL_ARGUMENT: s = "illegal argument"; break;
+	case BAD_BYTECODE: s = "bad bytecode"; break;
 	default: s = "syntax error"; break;
 	}
 	return s;
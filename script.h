@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <exception>
 #include <iosfwd>
 
@@ -10,6 +11,11 @@ class Script final {
 public:
 	static bool random_sleep; // Default: true
 	static bool ignore_space; // Default: true
+	static bool catch_interrupt; // Stop playing on SIGINT. Default: true
+	static unsigned int poll_interval_ms; // Of screen checks while waiting. Default: 20
+	// Bounds of pauses after events; adapted to the desktop's speed in between.
+	static unsigned int pace_min_ms; // Default: 50
+	static unsigned int pace_max_ms; // Default: 50
 
 	static void print_doc(std::ostream &out) noexcept;
 
@@ -27,7 +33,15 @@ public:
 	void append(std::istream &source);
 	void clear() noexcept;
 
-	void play(class Desktop &desktop) const;
+	// Write the compiled script in binary form, which can be loaded later
+	// without parsing the source again.
+	void save(std::ostream &out) const;
+	// Replace the script with compiled one written by `save()`.
+	void load(std::istream &source);
+
+	// Play on the desktop until the end, SIGINT (see `catch_interrupt`), or
+	// until `*stop` is set, if given.
+	void play(class Desktop &desktop, const std::atomic_bool *stop = nullptr) const;
 
 private:
 	struct Impl;
@@ -41,6 +55,7 @@ public:
 		UNKNOWN_KEY,
 		UNKNOWN_COMMAND,
 		ILLEGAL_ARGUMENT,
+		BAD_BYTECODE,
 	};
 
 	ScriptSyntaxError(Error e) noexcept : error(e) { }
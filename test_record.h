@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace vinput {
+
+// Binary recording of the test desktop: a TestRecordHeader followed by
+// TestRecords, each followed by `size` bytes of text (padded to 8 bytes).
+// Integers are in host byte order.
+
+#pragma pack(push, 1)
+
+struct TestRecordHeader {
+	char magic[8]; // "VINPUTEV"
+	std::uint32_t version;
+	std::uint32_t record_size; // sizeof(TestRecord)
+};
+
+struct TestRecord {
+	enum Type : std::uint8_t { KEY, BUTTON, SCROLL, POINTER, TARGET };
+
+	std::uint64_t sequence;
+	std::uint64_t time_ns; // Simulated or monotonic time since the desktop was connected.
+	Type type;
+	std::uint8_t press; // 1 for press, 0 for release.
+	std::uint16_t size; // Length of the text that follows (TARGET window).
+	std::uint32_t code; // Key or button.
+	std::int32_t x, y; // Pointer position or scroll distances.
+};
+
+#pragma pack(pop)
+
+static_assert(sizeof(TestRecord) == 32);
+
+inline constexpr char test_record_magic[8] = {'V', 'I', 'N', 'P', 'U', 'T', 'E', 'V'};
+inline constexpr std::uint32_t test_record_version = 1;
+
+// Append the record as a line of the text format of the test desktop.
+void format_test_record_text(std::string &out, const TestRecord &rec, std::string_view text);
+
+}
@@ -0,0 +1,247 @@
+#include "vinput.h"
+
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+
+#include "desktop.h"
+#include "desktops.h"
+#include "script.h"
+
+using namespace vinput;
+
+struct vinput_desktop {
+	Desktop *desktop;
+};
+
+struct vinput_script {
+	Script script;
+};
+
+struct vinput_playback {
+	std::thread thread;
+	std::atomic_bool stop = false;
+	std::atomic_bool done = false;
+	int status = VINPUT_OK;
+};
+
+static thread_local std::string last_error;
+
+static int set_error(int status, const char *message) noexcept {
+	try {
+		last_error = message;
+	} catch (const std::exception &) {
+		last_error.clear();
+	}
+	return status;
+}
+
+// Call the function, converting exceptions to status codes.
+template <typename Func> static int call(Func &&func) noexcept {
+	try {
+		func();
+		return VINPUT_OK;
+	} catch (const TraceDivergedError &e) {
+		return set_error(VINPUT_DIVERGED, e.what());
+	} catch (const ScriptSyntaxError &e) {
+		return set_error(VINPUT_SYNTAX_ERROR, e.what());
+	} catch (const std::exception &e) {
+		return set_error(VINPUT_ERROR, e.what());
+	}
+}
+
+static int play(
+		Desktop &desktop, const Script &script, const std::atomic_bool *stop = nullptr) noexcept {
+	return call([&] {
+		script.play(desktop, stop);
+		verify_desktop_finish(desktop);
+	});
+}
+
+static bool check_args(bool valid) noexcept {
+	if (!valid)
+		set_error(VINPUT_INVALID_ARGUMENT, "invalid argument");
+	return valid;
+}
+
+template <typename Event>
+static int send_press(vinput_desktop *desktop, int code, int count, vinput_action action) {
+	if (!check_args(
+			desktop && code >= 0 && code < count &&
+			action >= VINPUT_PRESS && action <= VINPUT_CLICK))
+		return VINPUT_INVALID_ARGUMENT;
+	return call([&] {
+		const auto c = static_cast<Event>(code);
+		auto &d = *desktop->desktop;
+		const auto send_event = [&d, c](Desktop::PressAction a) {
+			if constexpr (std::is_same_v<Event, Desktop::Key>)
+				d.key(c, a);
+			else
+				d.button(c, a);
+		};
+		if (action != VINPUT_RELEASE)
+			send_event(Desktop::PressAction::Press);
+		if (action != VINPUT_PRESS)
+			send_event(Desktop::PressAction::Release);
+	});
+}
+
+const char *vinput_last_error(void) {
+	return last_error.c_str();
+}
+
+vinput_desktop *vinput_connect(const char *name) {
+	// The program using the library owns the signal handlers. Set before any
+	// play, which needs a desktop, so that no play reads it meanwhile.
+	static std::once_flag no_interrupt;
+	std::call_once(no_interrupt, [] { Script::catch_interrupt = false; });
+
+	vinput_desktop *result = nullptr;
+	call([&] {
+		Desktop *const desktop = name && *name ?
+			connect_named_desktop(name) : connect_current_desktop();
+		try {
+			result = new vinput_desktop{desktop};
+		} catch (...) {
+			disconnect_desktop(desktop);
+			throw;
+		}
+	});
+	return result;
+}
+
+void vinput_disconnect(vinput_desktop *desktop) {
+	if (!desktop)
+		return;
+	disconnect_desktop(desktop->desktop);
+	delete desktop;
+}
+
+vinput_script *vinput_compile(const char *source, size_t size) {
+	if (!check_args(source || !size))
+		return nullptr;
+	vinput_script *result = nullptr;
+	call([&] {
+		std::istringstream ss(std::string(source, size));
+		auto script = new vinput_script;
+		try {
+			script->script.append(ss);
+		} catch (...) {
+			delete script;
+			throw;
+		}
+		result = script;
+	});
+	return result;
+}
+
+void vinput_script_free(vinput_script *script) {
+	delete script;
+}
+
+int vinput_play(vinput_desktop *desktop, const vinput_script *script) {
+	if (!check_args(desktop && script))
+		return VINPUT_INVALID_ARGUMENT;
+	return play(*desktop->desktop, script->script);
+}
+
+vinput_playback *vinput_play_async(vinput_desktop *desktop, const vinput_script *script) {
+	if (!check_args(desktop && script))
+		return nullptr;
+	vinput_playback *result = nullptr;
+	call([&] {
+		auto playback = new vinput_playback;
+		try {
+			playback->thread = std::thread([playback, desktop, script] {
+				playback->status = play(*desktop->desktop, script->script, &playback->stop);
+				playback->done = true;
+			});
+		} catch (...) {
+			delete playback;
+			throw;
+		}
+		result = playback;
+	});
+	return result;
+}
+
+int vinput_done(const vinput_playback *playback) {
+	return playback && playback->done;
+}
+
+int vinput_stop(vinput_playback *playback) {
+	if (!check_args(playback))
+		return VINPUT_INVALID_ARGUMENT;
+	playback->stop = true;
+	return VINPUT_OK;
+}
+
+int vinput_wait(vinput_playback *playback) {
+	if (!check_args(playback))
+		return VINPUT_INVALID_ARGUMENT;
+	playback->thread.join();
+	const auto status = playback->status;
+	delete playback;
+	return status;
+}
+
+int vinput_key_code(const char *name) {
+	if (!name)
+		return -1;
+	const auto [key, ok] = Desktop::key_from_name(name);
+	return ok ? int(key) : -1;
+}
+
+int vinput_button_code(const char *name) {
+	if (!name)
+		return -1;
+	const auto [button, ok] = Desktop::button_from_name(name);
+	return ok ? int(button) : -1;
+}
+
+int vinput_key(vinput_desktop *desktop, int key, vinput_action action) {
+	return send_press<Desktop::Key>(desktop, key, int(Desktop::Key::_COUNT), action);
+}
+
+int vinput_button(vinput_desktop *desktop, int button, vinput_action action) {
+	return send_press<Desktop::Button>(desktop, button, int(Desktop::Button::_COUNT), action);
+}
+
+int vinput_scroll(vinput_desktop *desktop, int dx, int dy) {
+	if (!check_args(desktop))
+		return VINPUT_INVALID_ARGUMENT;
+	return call([&] { desktop->desktop->scroll(dx, dy); });
+}
+
+int vinput_pointer_move(vinput_desktop *desktop, unsigned int x, unsigned int y) {
+	if (!check_args(desktop))
+		return VINPUT_INVALID_ARGUMENT;
+	return call([&] { desktop->desktop->pointer({x, y}); });
+}
+
+int vinput_pointer_get(vinput_desktop *desktop, unsigned int *x, unsigned int *y) {
+	if (!check_args(desktop && x && y))
+		return VINPUT_INVALID_ARGUMENT;
+	return call([&] {
+		const auto pos = desktop->desktop->pointer();
+		*x = pos.x;
+		*y = pos.y;
+	});
+}
+
+int vinput_target(vinput_desktop *desktop, const char *spec) {
+	if (!check_args(desktop))
+		return VINPUT_INVALID_ARGUMENT;
+	return call([&] { desktop->desktop->target(spec ? spec : ""); });
+}
+
+int vinput_flush(vinput_desktop *desktop) {
+	if (!check_args(desktop))
+		return VINPUT_INVALID_ARGUMENT;
+	return call([&] { desktop->desktop->flush(); });
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+// C interface of libvinput, for playing scripts and sending input events
+// from other programs without running the `vinput` executable.
+//
+// Functions returning `int` return VINPUT_OK or a negative error code;
+// functions returning pointers return NULL on failure. The message of the
+// last error on the calling thread is returned by vinput_last_error().
+// A desktop must not be used from several threads at once, including while
+// an asynchronous play on it has not been waited for.
+
+#include <stddef.h>
+
+#if defined(_WIN32)
+#	if defined(VINPUT_EXPORTS)
+#		define VINPUT_API __declspec(dllexport)
+#	elif defined(VINPUT_SHARED)
+#		define VINPUT_API __declspec(dllimport)
+#	else
+#		define VINPUT_API
+#	endif
+#else
+#	define VINPUT_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct vinput_desktop vinput_desktop;
+typedef struct vinput_script vinput_script;
+typedef struct vinput_playback vinput_playback;
+
+enum vinput_status {
+	VINPUT_OK = 0,
+	VINPUT_ERROR = -1,          // Desktop or system error.
+	VINPUT_SYNTAX_ERROR = -2,   // Bad script.
+	VINPUT_INVALID_ARGUMENT = -3,
+	VINPUT_DIVERGED = -4,       // Events differ from the expected trace ("verify" desktop).
+};
+
+enum vinput_action {
+	VINPUT_PRESS,
+	VINPUT_RELEASE,
+	VINPUT_CLICK, // Press and release.
+};
+
+// Message of the last error on the calling thread. Empty if none.
+VINPUT_API const char *vinput_last_error(void);
+
+// Connect a desktop by name, like "x11", "linux" or "test" (see
+// `vinput --list-desktops`), or the one in use if `name` is NULL or empty.
+VINPUT_API vinput_desktop *vinput_connect(const char *name);
+// Close the desktop. Accepts NULL.
+VINPUT_API void vinput_disconnect(vinput_desktop *desktop);
+
+// Compile script source of `size` bytes (see `vinput --help-script`).
+VINPUT_API vinput_script *vinput_compile(const char *source, size_t size);
+// Free the script. Accepts NULL.
+VINPUT_API void vinput_script_free(vinput_script *script);
+
+// Play the script and return when it is done. SIGINT is not caught.
+VINPUT_API int vinput_play(vinput_desktop *desktop, const vinput_script *script);
+// Start playing the script in another thread. The script and the desktop
+// must be kept until vinput_wait() returns.
+VINPUT_API vinput_playback *vinput_play_async(
+	vinput_desktop *desktop, const vinput_script *script);
+// Check whether the asynchronous play is done: 1 if so, 0 if not.
+VINPUT_API int vinput_done(const vinput_playback *playback);
+// Ask the asynchronous play to stop soon, even in a sleep, wait or loop
+// forever. It still has to be waited for; a stopped play returns VINPUT_OK.
+VINPUT_API int vinput_stop(vinput_playback *playback);
+// Wait for the asynchronous play, free it, and return its status.
+VINPUT_API int vinput_wait(vinput_playback *playback);
+
+// Code of the key or button, by the names used in scripts ("a", "ESCAPE",
+// "LEFT", ...). -1 if unknown.
+VINPUT_API int vinput_key_code(const char *name);
+VINPUT_API int vinput_button_code(const char *name);
+
+// Send events. They may be queued until vinput_flush().
+VINPUT_API int vinput_key(vinput_desktop *desktop, int key, enum vinput_action action);
+VINPUT_API int vinput_button(vinput_desktop *desktop, int button, enum vinput_action action);
+// Distances are in 1/120 of a wheel notch; positive values scroll right / up.
+VINPUT_API int vinput_scroll(vinput_desktop *desktop, int dx, int dy);
+VINPUT_API int vinput_pointer_move(vinput_desktop *desktop, unsigned int x, unsigned int y);
+VINPUT_API int vinput_pointer_get(vinput_desktop *desktop, unsigned int *x, unsigned int *y);
+// Send keys to the window (ID, class:NAME or title:TEXT), or the focused
+// window if `spec` is NULL or empty.
+VINPUT_API int vinput_target(vinput_desktop *desktop, const char *spec);
+VINPUT_API int vinput_flush(vinput_desktop *desktop);
+
+#ifdef __cplusplus
+}
+#endif